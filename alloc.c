@@ -0,0 +1,182 @@
+/*
+ * alloc.c - conversions into output buffers which we allocate
+ * ourselves, growing them as we go.
+ */
+
+#include <stdlib.h>
+
+#include "charset.h"
+#include "internal.h"
+
+static void *std_alloc(void *ctx, size_t size)
+{
+    UNUSEDARG(ctx);
+    return malloc(size);
+}
+
+static void *std_realloc(void *ctx, void *ptr, size_t oldsize, size_t newsize)
+{
+    UNUSEDARG(ctx);
+    UNUSEDARG(oldsize);
+    return realloc(ptr, newsize);
+}
+
+static void std_free(void *ctx, void *ptr, size_t size)
+{
+    UNUSEDARG(ctx);
+    UNUSEDARG(size);
+    free(ptr);
+}
+
+static const charset_allocator std_allocator = {
+    std_alloc, std_realloc, std_free, NULL
+};
+
+/*
+ * Make room for at least `needed' units of `unit' bytes each,
+ * doubling the buffer so that growing it costs amortised constant
+ * time per unit. Returns the new buffer, or NULL (having freed the
+ * old one) if we can't.
+ */
+static void *grow(const charset_allocator *al, void *buf, size_t *size,
+		  size_t needed, size_t unit)
+{
+    size_t newsize = *size;
+    void *newbuf;
+
+    while (newsize < needed) {
+	if (newsize > ((size_t)-1 / unit) / 2) {
+	    al->free(al->ctx, buf, *size * unit);
+	    return NULL;
+	}
+	newsize *= 2;
+    }
+    if (newsize == *size)
+	return buf;
+
+    newbuf = al->realloc(al->ctx, buf, *size * unit, newsize * unit);
+    if (!newbuf) {
+	al->free(al->ctx, buf, *size * unit);
+	return NULL;
+    }
+    *size = newsize;
+    return newbuf;
+}
+
+/*
+ * Give back the unused end of a buffer, so that its size is the
+ * one we tell the caller about.
+ */
+static void *trim(const charset_allocator *al, void *buf, size_t size,
+		  size_t used, size_t unit)
+{
+    void *newbuf;
+
+    if (size == used)
+	return buf;
+    newbuf = al->realloc(al->ctx, buf, size * unit, used * unit);
+    return newbuf ? newbuf : buf;
+}
+
+wchar_t *charset_to_unicode_alloc(const char **input, size_t *inlen,
+				  int charset, charset_state *state,
+				  const wchar_t *errstr, size_t errlen,
+				  size_t *outlen,
+				  const charset_allocator *alloc)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state localstate = CHARSET_INIT_STATE;
+    wchar_t *buf;
+    size_t size, len = 0;
+
+    if (!spec)
+	return NULL;
+    if (!alloc)
+	alloc = &std_allocator;
+    if (state)
+	localstate = *state;	       /* structure copy */
+
+    /*
+     * Most charsets produce at most one wide character per byte,
+     * so start with that much room and we won't usually have to
+     * grow at all.
+     */
+    size = (*inlen < 15 ? 16 : *inlen + 1);
+    buf = (wchar_t *)alloc->alloc(alloc->ctx, size * sizeof(wchar_t));
+    if (!buf)
+	return NULL;
+
+    while (1) {
+	len += spec_to_unicode(spec, input, inlen, buf + len,
+			       size - 1 - len, &localstate,
+			       errstr, errlen, NULL, NULL, NULL, NULL, NULL);
+	if (*inlen == 0)
+	    break;
+	buf = (wchar_t *)grow(alloc, buf, &size, size + 1, sizeof(wchar_t));
+	if (!buf)
+	    return NULL;
+    }
+
+    buf[len] = L'\0';
+    if (state)
+	*state = localstate;	       /* structure copy */
+    if (outlen)
+	*outlen = len;
+    return (wchar_t *)trim(alloc, buf, size, len + 1, sizeof(wchar_t));
+}
+
+char *charset_from_unicode_alloc(const wchar_t **input, size_t *inlen,
+				 int charset, charset_state *state,
+				 int *error, size_t *outlen,
+				 const charset_allocator *alloc)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state localstate = CHARSET_INIT_STATE;
+    char *buf;
+    size_t size, len = 0;
+    int err = FALSE;
+
+    if (!spec)
+	return NULL;
+    if (!alloc)
+	alloc = &std_allocator;
+    if (state)
+	localstate = *state;	       /* structure copy */
+
+    size = (*inlen < 15 ? 16 : *inlen + 1);
+    buf = (char *)alloc->alloc(alloc->ctx, size);
+    if (!buf)
+	return NULL;
+
+    while (1) {
+	len += spec_from_unicode(spec, input, inlen, buf + len,
+				 size - 1 - len, &localstate,
+				 (error ? &err : NULL), NULL);
+	if (*inlen == 0 || err)
+	    break;
+	buf = (char *)grow(alloc, buf, &size, size + 1, 1);
+	if (!buf)
+	    return NULL;
+    }
+
+    /*
+     * With nowhere to keep the state, the output had better end
+     * in the initial state.
+     */
+    if (!state && !err) {
+	buf = (char *)grow(alloc, buf, &size, len + 1 + spec->maxreset, 1);
+	if (!buf)
+	    return NULL;
+	len += spec_from_unicode(spec, NULL, NULL, buf + len, size - 1 - len,
+				 &localstate, NULL, NULL);
+    }
+
+    buf[len] = '\0';
+    if (state)
+	*state = localstate;	       /* structure copy */
+    if (error)
+	*error = err;
+    if (outlen)
+	*outlen = len;
+    return (char *)trim(alloc, buf, size, len + 1, 1);
+}
@@ -0,0 +1,195 @@
+/*
+ * batch.c - convert a whole column of short strings at once.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+static void batch_error(void *ctx, size_t offset, size_t length)
+{
+    UNUSEDARG(offset);
+    UNUSEDARG(length);
+
+    *(int *)ctx = TRUE;
+}
+
+size_t charset_to_unicode_batch(int charset, const char *data,
+				const size_t *offsets, size_t nstrings,
+				wchar_t *output, size_t outlen,
+				size_t *outoffsets,
+				const wchar_t *errstr, size_t errlen,
+				unsigned char *errbits)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    static const wchar_t replacement = 0xFFFD;
+    size_t i, written = 0;
+
+    if (!errstr) {
+	errstr = &replacement;
+	errlen = 1;
+    }
+
+    outoffsets[0] = 0;
+    for (i = 0; i < nstrings; i++) {
+	const char *input = data + offsets[i];
+	size_t inlen = offsets[i+1] - offsets[i];
+	charset_state state = CHARSET_INIT_STATE;
+	size_t room = (outlen == CHARSET_UNBOUNDED ? outlen :
+		       outlen - written);
+	size_t ret;
+	int errors = FALSE;
+
+	ret = spec_to_unicode(spec, &input, &inlen,
+			      (output ? output + written : NULL), room,
+			      &state, errstr, errlen,
+			      batch_error, &errors, NULL, NULL, NULL);
+	if (inlen > 0)
+	    break;		       /* this string doesn't fit */
+
+	if (spec->midchar && spec->midchar(spec, &state)) {
+	    /*
+	     * The string ended part-way through a character, which
+	     * can't be finished off by the next one since they're
+	     * independent; so that's an error too.
+	     */
+	    if (room != CHARSET_UNBOUNDED && room - ret < errlen)
+		break;
+	    if (output) {
+		size_t j;
+		for (j = 0; j < errlen; j++)
+		    output[written + ret + j] = errstr[j];
+	    }
+	    ret += errlen;
+	    errors = TRUE;
+	}
+
+	written += ret;
+	outoffsets[i+1] = written;
+	if (errbits) {
+	    if (errors)
+		errbits[i / 8] |= 1 << (i % 8);
+	    else
+		errbits[i / 8] &= ~(1 << (i % 8));
+	}
+    }
+
+    return i;
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+int total_errs = 0;
+
+struct batch_case {
+    const char *input;
+    const wchar_t *output;
+    int error;
+};
+
+/*
+ * Decode the strings in `cases' as one batch, with `outlen' units
+ * of output space, and check the output, the output offsets, the
+ * error bits and the number of strings converted. The error bits
+ * start off all set, so that we can see them cleared as well.
+ */
+void batch_test(int line, int charset, const struct batch_case *cases,
+		size_t ncases, size_t outlen, int nooutput)
+{
+    char data[256];
+    size_t offsets[33], outoffsets[33], expoffsets[33];
+    wchar_t output[256], expected[256];
+    unsigned char errbits[4], experrbits[4];
+    size_t i, ret, expret;
+
+    offsets[0] = expoffsets[0] = 0;
+    memset(experrbits, 0xFF, sizeof(experrbits));
+    expret = ncases;
+    for (i = 0; i < ncases; i++) {
+	size_t inlen = strlen(cases[i].input);
+	size_t wlen = wcslen(cases[i].output);
+
+	memcpy(data + offsets[i], cases[i].input, inlen);
+	offsets[i+1] = offsets[i] + inlen;
+	memcpy(expected + expoffsets[i], cases[i].output,
+	       wlen * sizeof(wchar_t));
+	expoffsets[i+1] = expoffsets[i] + wlen;
+	if (expoffsets[i+1] > outlen && expret == ncases)
+	    expret = i;
+	if (expret == ncases && !cases[i].error)
+	    experrbits[i / 8] &= ~(1 << (i % 8));
+    }
+
+    memset(errbits, 0xFF, sizeof(errbits));
+    ret = charset_to_unicode_batch(charset, data, offsets, ncases,
+				   (nooutput ? NULL : output), outlen,
+				   outoffsets, L"<?>", 3, errbits);
+    if (ret != expret) {
+	printf("%d (outlen %d): converted %d strings, expected %d\n",
+	       line, (int)outlen, (int)ret, (int)expret);
+	total_errs++;
+	return;
+    }
+    for (i = 0; i <= ret; i++) {
+	if (outoffsets[i] != expoffsets[i]) {
+	    printf("%d (outlen %d): string %d at offset %d, expected %d\n",
+		   line, (int)outlen, (int)i, (int)outoffsets[i],
+		   (int)expoffsets[i]);
+	    total_errs++;
+	    return;
+	}
+    }
+    if (!nooutput &&
+	memcmp(output, expected, expoffsets[ret] * sizeof(wchar_t))) {
+	printf("%d (outlen %d): output differs\n", line, (int)outlen);
+	total_errs++;
+    }
+    if (memcmp(errbits, experrbits, sizeof(errbits))) {
+	printf("%d (outlen %d): error bits %02x %02x, expected %02x %02x\n",
+	       line, (int)outlen, errbits[0], errbits[1],
+	       experrbits[0], experrbits[1]);
+	total_errs++;
+    }
+}
+
+int main(void)
+{
+    static const struct batch_case utf8[] = {
+	{ "abc", L"abc", 0 },
+	{ "", L"", 0 },
+	{ "caf\xC3\xA9", L"caf\xE9", 0 },
+	{ "x\xC3", L"x<?>", 1 },       /* ends part-way through */
+	{ "\xFF", L"<?>", 1 },
+	{ "\xE6\x97\xA5", L"\x65E5", 0 },
+	{ "\xC3", L"<?>", 1 },
+	{ "", L"", 0 },
+	{ "d", L"d", 0 },
+	{ "\xE6\x97", L"<?>", 1 },
+	{ "ef", L"ef", 0 },
+    };
+    static const struct batch_case sjis[] = {
+	{ "\x93\xFA\x96\x7B", L"\x65E5\x672C", 0 },
+	{ "a\x93", L"a<?>", 1 },       /* ends on a lead byte */
+	{ "\x93", L"<?>", 1 },
+	{ "b", L"b", 0 },
+    };
+    size_t outlen;
+
+    printf("batch tests beginning\n");
+    for (outlen = 0; outlen <= 30; outlen++) {
+	batch_test(__LINE__, CS_UTF8, utf8, lenof(utf8), outlen, FALSE);
+	batch_test(__LINE__, CS_SHIFT_JIS, sjis, lenof(sjis), outlen, FALSE);
+    }
+    batch_test(__LINE__, CS_UTF8, utf8, lenof(utf8), CHARSET_UNBOUNDED, TRUE);
+    batch_test(__LINE__, CS_SHIFT_JIS, sjis, lenof(sjis),
+	       CHARSET_UNBOUNDED, TRUE);
+    printf("batch tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
@@ -8,7 +8,8 @@
 #include "internal.h"
 
 /*
- * Big5 has no associated data, so `charset' may be ignored.
+ * The Big5 read and write functions need no associated data (the
+ * spec's data is for dbcs.c), so `charset' may be ignored.
  */
 
 static void read_big5(charset_spec const *charset, long int input_chr,
@@ -50,6 +51,11 @@ static void read_big5(charset_spec const *charset, long int input_chr,
     }
 }
 
+/* Big5 lead bytes are A1-FE, for the shared functions in dbcs.c. */
+static const struct dbcs_data big5_data = {
+    { 0, 0, 0, 0, 0, 0xFFFFFFFE, 0xFFFFFFFF, 0x7FFFFFFF }
+};
+
 /*
  * Big5 is a stateless multi-byte encoding (in the sense that just
  * after any character has been completed, the state is always the
@@ -83,7 +89,9 @@ static int write_big5(charset_spec const *charset, long int input_chr,
 }
 
 const charset_spec charset_CS_BIG5 = {
-    CS_BIG5, read_big5, write_big5, NULL
+    CS_BIG5, read_big5, write_big5, &big5_data,
+    NULL, NULL, read_dbcs_count, NULL, midchar_dbcs, NULL, sync_dbcs,
+    2, 0, 1, CSF_STATELESS | CSF_ASCII
 };
 
 #else /* ENUM_CHARSETS */
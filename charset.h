@@ -188,6 +188,640 @@ int charset_from_unicode(const wchar_t **input, int *inlen,
 			 char *output, int outlen,
 			 int charset, charset_state *state, int *error);
 
+/*
+ * Variants of the above two routines which use size_t for all
+ * lengths, so that a single call can convert more than 2Gb of
+ * data (for example, an entire memory-mapped file). They behave
+ * exactly like the int versions, except that an unlimited output
+ * buffer is indicated by passing CHARSET_UNBOUNDED as `outlen'
+ * rather than a negative number.
+ */
+#define CHARSET_UNBOUNDED ((size_t)-1)
+
+size_t charset_to_unicode_sz(const char **input, size_t *inlen,
+			     wchar_t *output, size_t outlen,
+			     int charset, charset_state *state,
+			     const wchar_t *errstr, size_t errlen);
+size_t charset_from_unicode_sz(const wchar_t **input, size_t *inlen,
+			       char *output, size_t outlen,
+			       int charset, charset_state *state, int *error);
+
+/*
+ * Routines to find out how much output a conversion would produce,
+ * without actually doing it. They process the whole of the input,
+ * and return the number of wide characters or bytes which
+ * charset_to_unicode_sz() or charset_from_unicode_sz() would have
+ * output given the same input and an unlimited output buffer. If
+ * `state' is non-NULL it is updated just as the real conversion
+ * would have updated it.
+ * 
+ * `errstr' is not read; it and `errlen' mean the same as they do
+ * for charset_to_unicode(), so that you can pass the same values
+ * you're going to pass to the real conversion. Characters which
+ * cannot be expressed in the output charset are not counted, just
+ * as charset_from_unicode() ignores them when `error' is NULL.
+ * 
+ * These are much faster than a dry run through the conversion
+ * functions for the common charsets, since they can mostly avoid
+ * translating anything. (In fact a dry run with an unlimited
+ * output buffer now simply calls these, unless it's
+ * charset_from_unicode() with a non-NULL `error', which has to stop
+ * at the first character it can't encode.)
+ * 
+ * If `input' is NULL, charset_measure_from_unicode() reports the
+ * number of bytes needed to reset the encoding state.
+ */
+size_t charset_measure_to_unicode(const char *input, size_t inlen,
+				  int charset, charset_state *state,
+				  const wchar_t *errstr, size_t errlen);
+size_t charset_measure_from_unicode(const wchar_t *input, size_t inlen,
+				    int charset, charset_state *state);
+
+/*
+ * Routines which allocate their own output buffer, so that you
+ * needn't measure the output first and then convert it a second
+ * time. They convert the whole of the input in one pass, growing
+ * the buffer as necessary, and return it with a zero terminator
+ * after the output proper; `*outlen', if `outlen' is non-NULL, is
+ * set to the length not counting the terminator. They return NULL
+ * if the charset is unknown or if memory runs out.
+ * 
+ * The other arguments mean what they do for
+ * charset_to_unicode_sz() and charset_from_unicode_sz(). In
+ * particular, if `error' is non-NULL and a character turns up
+ * which can't be expressed in the output charset,
+ * charset_from_unicode_alloc() stops just before it, sets `*error'
+ * to TRUE and returns the output so far, with `*input' and
+ * `*inlen' telling you where it got to. If `state' is NULL, the
+ * output of charset_from_unicode_alloc() ends with whatever is
+ * needed to return the encoding to its initial state.
+ * 
+ * Memory is obtained from `alloc', or from malloc() if `alloc' is
+ * NULL. Its functions are passed its `ctx' field, and they are
+ * told the existing size of any block they're asked to resize or
+ * free, which makes it easy to back them with an arena: if a block
+ * being enlarged is the last one allocated from the arena, it can
+ * simply be extended. The buffer is only ever resized to be at
+ * least twice as big, so the work of growing it is in proportion
+ * to the output. Free the returned buffer with alloc->free()
+ * (passing a size of `*outlen'+1 units), or with free() if you
+ * passed NULL.
+ */
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t oldsize, size_t newsize);
+    void (*free)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+} charset_allocator;
+
+wchar_t *charset_to_unicode_alloc(const char **input, size_t *inlen,
+				  int charset, charset_state *state,
+				  const wchar_t *errstr, size_t errlen,
+				  size_t *outlen,
+				  const charset_allocator *alloc);
+char *charset_from_unicode_alloc(const wchar_t **input, size_t *inlen,
+				 int charset, charset_state *state,
+				 int *error, size_t *outlen,
+				 const charset_allocator *alloc);
+
+/*
+ * Version of charset_to_unicode_sz() which also tells you where
+ * the errors were. Each time the decoder meets an invalid
+ * sequence, it substitutes `errstr' as usual and then calls
+ * `errfn', passing `errctx', the offset of the offending sequence
+ * from the value `*input' had on entry, and its length in bytes.
+ * (So, for example, an incomplete UTF-8 sequence cut short by an
+ * ASCII character is reported as covering just the incomplete
+ * sequence, and not the ASCII character after it.) Errors are
+ * reported in the order they occur in the input, so if you want a
+ * list of them, just have `errfn' append to an array.
+ *
+ * If a sequence began in a previous call (so that its first bytes
+ * are no longer available) it is reported as starting at offset
+ * 0. `errfn' is never called for input which was not consumed.
+ *
+ * Reporting error positions costs a little speed over the plain
+ * conversion, but only while the input is in error; runs of valid
+ * text still go through the fast paths.
+ */
+size_t charset_to_unicode_errors(const char **input, size_t *inlen,
+				 wchar_t *output, size_t outlen,
+				 int charset, charset_state *state,
+				 const wchar_t *errstr, size_t errlen,
+				 void (*errfn)(void *ctx, size_t offset,
+					       size_t length),
+				 void *errctx);
+
+/*
+ * Version of charset_to_unicode_sz() for callers who don't want the
+ * output in a buffer at all, but want to pass it straight on to
+ * something else such as a tokeniser. Instead of being written
+ * out, the decoded characters are handed to `sink' a block at a
+ * time: each call passes `sinkctx', a pointer to `n' characters,
+ * and a pointer to `n' offsets, the offset of each character being
+ * that of the start of the sequence it was decoded from, measured
+ * from `input'. Characters substituted for invalid sequences
+ * (`errstr', or U+FFFD if that is NULL) are given the offset of the
+ * invalid sequence, found the same way as for
+ * charset_to_unicode_errors(). A character whose sequence began in
+ * a previous call is given offset 0.
+ * 
+ * The whole of the input is always consumed, and the return value
+ * is the total number of characters passed to `sink'. `n' is never
+ * zero, and the arrays passed to `sink' are only valid until it
+ * returns.
+ */
+size_t charset_to_unicode_sink(const char *input, size_t inlen,
+			       int charset, charset_state *state,
+			       const wchar_t *errstr, size_t errlen,
+			       void (*sink)(void *ctx, const wchar_t *chars,
+					    const size_t *offsets, size_t n),
+			       void *sinkctx);
+
+/*
+ * Version of charset_to_unicode_sz() for line-based text such as
+ * logs or mailboxes, which tells you where each line ends as it
+ * goes, so that you don't have to search the output for newlines
+ * afterwards.
+ * 
+ * Each time it decodes an LF, it calls `linefn' (if non-NULL),
+ * passing `linectx' and a charset_line describing the line ending:
+ * `outpos' and `outend' give its span in the output (counting from
+ * `output'), covering the preceding CR too if there was one, and
+ * `inpos' and `inend' give the span of input bytes it was decoded
+ * from (counting from the value `*input' had on entry). `state' is
+ * the decoding state at `inend', where the next line begins; for
+ * stateful charsets such as ISO-2022, HZ and UTF-7, you can save
+ * that and use it to decode each line independently later. A CR
+ * decoded in a previous call isn't counted as part of the line
+ * ending.
+ * 
+ * If `linefn' returns TRUE, the conversion stops just after that
+ * line ending, with `*input' and `*inlen' updated to show where,
+ * so you can deal with one line at a time. Otherwise it carries on
+ * until the input is used up or the output buffer is full, exactly
+ * as charset_to_unicode_sz() would.
+ */
+typedef struct {
+    size_t outpos, outend;
+    size_t inpos, inend;
+    charset_state state;
+} charset_line;
+
+size_t charset_to_unicode_lines(const char **input, size_t *inlen,
+				wchar_t *output, size_t outlen,
+				int charset, charset_state *state,
+				const wchar_t *errstr, size_t errlen,
+				int (*linefn)(void *ctx,
+					      const charset_line *line),
+				void *linectx);
+
+/*
+ * Routine to decode a lot of short, independent strings in one
+ * charset, such as a column of a database table, with less
+ * overhead per string than calling charset_to_unicode_sz() on
+ * each of them.
+ * 
+ * The strings are stored one after another in `data', and string
+ * i occupies the bytes from `offsets[i]' up to `offsets[i+1]'; so
+ * `offsets' has `nstrings'+1 elements. The output is laid out the
+ * same way: the decoded strings are written one after another into
+ * `output', and the routine fills in `outoffsets', which must also
+ * have room for `nstrings'+1 elements, with offsets into that.
+ * 
+ * Each string is decoded from the initial state, and a string
+ * which ends part-way through a character is treated as having an
+ * invalid sequence at the end. Invalid sequences are replaced with
+ * `errstr' as usual. If `errbits' is non-NULL, it is treated as an
+ * array of bits, bit i being (errbits[i/8] >> (i%8)) & 1, and the
+ * bit for each string is set if the string contained any invalid
+ * sequences and cleared otherwise.
+ * 
+ * Strings are converted whole or not at all. The return value is
+ * the number of strings converted, which is less than `nstrings'
+ * only if the next one wouldn't fit in the output buffer; you can
+ * then carry on by calling again with `offsets' advanced past the
+ * strings that were done (and somewhere new for the error bits, if
+ * you want them). `output' may be NULL and `outlen'
+ * CHARSET_UNBOUNDED, in which case this simply works out the
+ * output offsets.
+ */
+size_t charset_to_unicode_batch(int charset, const char *data,
+				const size_t *offsets, size_t nstrings,
+				wchar_t *output, size_t outlen,
+				size_t *outoffsets,
+				const wchar_t *errstr, size_t errlen,
+				unsigned char *errbits);
+
+/*
+ * Version of charset_to_unicode_sz() for converting very large
+ * inputs using several threads. For charsets which can be picked
+ * up part-way through (UTF-8, UTF-16, the SBCSes, and the EUC,
+ * Shift-JIS, Big5 and CP949 multibyte charsets, which all get
+ * back in step at an ASCII byte), the input is divided into
+ * pieces at points where that's safe. The ISO-2022 charsets are
+ * treated the same way, dividing the input after control
+ * characters such as newlines; working out the designations in
+ * force at each of those takes a quick pass over the escape
+ * sequences before it. The output size of each piece is measured,
+ * and then the pieces are converted into their places in the
+ * output buffer, each of those steps being done for all the pieces
+ * at once. The output, and the final state, are
+ * exactly what charset_to_unicode_sz() would have produced. Other
+ * charsets, and inputs too small to be worth splitting, are simply
+ * passed to charset_to_unicode_sz().
+ * 
+ * The library doesn't start any threads itself. Instead, you pass
+ * a charset_runner whose `run' function must call `job(jobctx, i)'
+ * for each i from 0 to `njobs'-1, in any order and as concurrently
+ * as it likes, and return when they have all finished (in such a
+ * way that their memory writes are visible to the caller). It is
+ * passed the runner's `ctx' field. `nworkers' is the number of
+ * jobs it can usefully run at once, and the input is split into at
+ * most that many pieces. If `run' is NULL the jobs are run one
+ * after another, which is only useful for testing.
+ */
+typedef struct {
+    void (*run)(void *ctx, size_t njobs,
+		void (*job)(void *jobctx, size_t i), void *jobctx);
+    void *ctx;
+    size_t nworkers;
+} charset_runner;
+
+size_t charset_to_unicode_parallel(const char **input, size_t *inlen,
+				   wchar_t *output, size_t outlen,
+				   int charset, charset_state *state,
+				   const wchar_t *errstr, size_t errlen,
+				   const charset_runner *runner);
+
+/*
+ * The same thing in the other direction: a version of
+ * charset_from_unicode_sz() which divides large inputs into pieces
+ * and encodes them all at once, using `runner' as above. As with
+ * charset_from_unicode_sz() and a NULL `error', characters which
+ * can't be expressed in the output charset are ignored.
+ * 
+ * This works for stateful charsets too (ISO-2022, UTF-7, HZ and so
+ * on), and the output is still exactly what the serial routine
+ * would have produced: each piece is first measured as if it
+ * started in the initial state, and then corrected by encoding its
+ * first few characters from the state it really starts in, until
+ * the two agree (typically after the first character that needs a
+ * shift or an escape sequence). A piece in which they never agree,
+ * such as a long run of UTF-7 base64, ends up being measured
+ * serially, which is correct but slower.
+ * 
+ * If `input' is NULL, this resets the encoding state exactly as
+ * charset_from_unicode_sz() does.
+ */
+size_t charset_from_unicode_parallel(const wchar_t **input, size_t *inlen,
+				     char *output, size_t outlen,
+				     int charset, charset_state *state,
+				     const charset_runner *runner);
+
+/*
+ * A charset_reencoder keeps the encoded form of a piece of Unicode
+ * text, such as an editor buffer, up to date as the text is edited,
+ * so that saving it after a small change doesn't mean encoding the
+ * whole lot again.
+ * 
+ * charset_reencoder_new() encodes `text' in `charset' and returns a
+ * reencoder holding the result, or NULL if it runs out of memory.
+ * It doesn't keep a pointer to `text'.
+ * 
+ * After each edit, call charset_reencoder_edit() with the whole of
+ * the new text, and a description of the edit: `dellen' characters
+ * were removed at `pos', and `inslen' inserted in their place. Only
+ * the output around the edit is re-encoded: for stateful charsets
+ * (ISO-2022, UTF-7, HZ), re-encoding carries on past the edit until
+ * the encoder is back in the state it was in before, which is
+ * usually soon. It returns FALSE if the edit doesn't fit the
+ * previous text, or if it runs out of memory; either way the
+ * reencoder still holds the encoding of the previous text.
+ * 
+ * charset_reencoder_output() returns the length of the encoded
+ * text, including any sequence needed at the end to return the
+ * output to its initial state. If `output' is non-NULL and `outlen'
+ * is at least that length (or CHARSET_UNBOUNDED), it also writes the
+ * text there. The output is always exactly what
+ * charset_from_unicode_sz() followed by a reset would produce from
+ * the current text, ignoring characters that the charset can't
+ * encode.
+ */
+typedef struct charset_reencoder charset_reencoder;
+
+charset_reencoder *charset_reencoder_new(int charset,
+					 const wchar_t *text, size_t len);
+void charset_reencoder_free(charset_reencoder *re);
+int charset_reencoder_edit(charset_reencoder *re,
+			   const wchar_t *text, size_t len,
+			   size_t pos, size_t dellen, size_t inslen);
+size_t charset_reencoder_output(charset_reencoder *re,
+				char *output, size_t outlen);
+
+/*
+ * Routines for jumping into the middle of a large input, such as a
+ * log file in ISO-2022-JP, without decoding everything before the
+ * place you want.
+ * 
+ * charset_build_index() decodes the whole of `input' once (without
+ * writing the output anywhere) and records a checkpoint roughly
+ * every `interval' bytes: the offset, the number of wide
+ * characters decoded before it (with invalid sequences replaced by
+ * `errstr', as for charset_to_unicode_sz()), and the decoding state
+ * there. Checkpoints are always at character boundaries, and the
+ * first is at offset 0. It writes up to `maxindex' of them into
+ * `index', and returns how many the input has; so you can call it
+ * with `maxindex' of inlen/interval+1 and be sure of room, or find
+ * out the size first by passing zero.
+ * 
+ * charset_index_seek() uses such an index to find the decoding
+ * state at `offset': it starts from the last checkpoint at or
+ * before there, and decodes forward to `offset', or to the end of
+ * the character `offset' is in the middle of. It returns the
+ * offset it stopped at, and sets `*state' to the state there and
+ * `*chars' to the number of wide characters before it (either may
+ * be NULL). You can then carry on decoding from there with
+ * charset_to_unicode_sz() and the returned state, and the output
+ * will be exactly what decoding from the start would have given.
+ * So the cost of a seek depends on `interval', not the size of the
+ * input.
+ * 
+ * Going the other way, charset_index_char_offset() returns the
+ * offset of the input sequence that wide character number
+ * `charpos' of the output was decoded from (reported as for
+ * charset_to_unicode_sink()), or `inlen' if the output isn't that
+ * long. Between them, these two translate in both directions
+ * between byte offsets in the input and positions in the decoded
+ * text, with a binary search of the index and a decode of at most
+ * about `interval' bytes. `errstr' and `errlen' must be the same
+ * as were used to build the index, since they affect the count of
+ * characters.
+ */
+typedef struct {
+    size_t offset;		       /* in the input */
+    size_t chars;		       /* decoded before this point */
+    charset_state state;	       /* decoding state at this point */
+} charset_checkpoint;
+
+size_t charset_build_index(int charset, const char *input, size_t inlen,
+			   size_t interval,
+			   const wchar_t *errstr, size_t errlen,
+			   charset_checkpoint *index, size_t maxindex);
+size_t charset_index_seek(int charset, const char *input, size_t inlen,
+			  const charset_checkpoint *index, size_t nindex,
+			  size_t offset,
+			  const wchar_t *errstr, size_t errlen,
+			  charset_state *state, size_t *chars);
+size_t charset_index_char_offset(int charset, const char *input,
+				 size_t inlen,
+				 const charset_checkpoint *index,
+				 size_t nindex, size_t charpos,
+				 const wchar_t *errstr, size_t errlen);
+
+/*
+ * Routines to convert a charset_state to and from a fixed-size
+ * string of bytes, CHARSET_STATE_BYTES long, which is the same on
+ * every platform; so an index built as above can be saved in a file
+ * and used again later, or elsewhere. (The serialised form doesn't
+ * say which charset the state belongs to, so you'll need to keep
+ * track of that yourself.)
+ */
+#define CHARSET_STATE_BYTES 8
+void charset_state_serialise(charset_state const *state, unsigned char *buf);
+void charset_state_deserialise(charset_state *state, const unsigned char *buf);
+
+/*
+ * Routine to check whether some input is well-formed in a given
+ * charset, without converting it. Returns TRUE if decoding all of
+ * `input' from the default state would produce no errors and would
+ * not leave the decoder part-way through a character. If
+ * `badoffset' is non-NULL, it is set to the offset of the start of
+ * the first invalid sequence, or to `inlen' if there isn't one.
+ * 
+ * This is considerably faster than running charset_to_unicode()
+ * over the input, particularly for UTF-8, UTF-16 and the SBCSes.
+ */
+int charset_validate(int charset, const char *input, size_t inlen,
+		     size_t *badoffset);
+
+/*
+ * Routines to compare text by its meaning rather than by its bytes,
+ * for example to spot the same message arriving in ISO-2022-JP,
+ * Shift-JIS and UTF-8. Both decode their input a little at a time
+ * in a small fixed buffer, so they take no more memory for long
+ * input than for short.
+ * 
+ * charset_hash() returns a 32-bit hash of the characters `input'
+ * decodes to, starting with `seed' (which may be zero). Text which
+ * decodes to the same characters in whatever charsets has the same
+ * hash.
+ * 
+ * charset_equal() returns TRUE if `a' in `charset_a' decodes to
+ * the same characters as `b' in `charset_b'. It stops at the first
+ * difference, so text which differs early on is quickly dismissed.
+ * 
+ * Both decode from the default state. Invalid sequences are treated
+ * as U+FFFD, including one cut short by the end of the input.
+ */
+unsigned long charset_hash(int charset, const char *input, size_t inlen,
+			   unsigned long seed);
+int charset_equal(int charset_a, const char *a, size_t len_a,
+		  int charset_b, const char *b, size_t len_b);
+
+/*
+ * Routine to search for a Unicode string in encoded text, without
+ * decoding the whole text. Returns TRUE if `haystack', decoded from
+ * the default state, contains the `needlelen' characters at
+ * `needle', and sets `*offset' (if `offset' is non-NULL) to the
+ * offset of the input sequence that the first of them was decoded
+ * from, as charset_to_unicode_sink() would report it. If not, it
+ * returns FALSE and sets `*offset' to `len'. An empty needle is
+ * found at offset 0.
+ * 
+ * For stateless charsets (the SBCSes, UTF-8, EUC, Shift-JIS, Big5
+ * and CP949), the needle is encoded into the haystack's charset
+ * and searched for as bytes, and each match is then checked to
+ * make sure it really begins and ends on character boundaries (in
+ * Shift-JIS, say, a second byte can look like an ASCII character).
+ * That's much faster than decoding, but it only finds the needle
+ * where it appears in the encoding charset_from_unicode() would
+ * give it; where a charset can encode a character in more than one
+ * way, the others aren't found. Other charsets, such as ISO-2022
+ * and UTF-16, are searched by decoding them.
+ * 
+ * Invalid sequences in the haystack are matched by U+FFFD in the
+ * needle. The routine returns FALSE if it runs out of memory.
+ */
+int charset_search(int charset, const char *haystack, size_t len,
+		   const wchar_t *needle, size_t needlelen, size_t *offset);
+
+/*
+ * Routine to convert directly from one MB/SB character set to
+ * another, without the caller having to manage a Unicode buffer
+ * in between.
+ * 
+ * This routine behaves like charset_to_unicode() and
+ * charset_from_unicode() chained together, keeping a separate
+ * state variable for each of the two charsets. It returns the
+ * number of bytes output, will never output more than the size of
+ * the buffer, and will never output a partial MB character.
+ * Advances the `input' pointer and decrements `inlen', to indicate
+ * how far along the input string it got: every input byte it
+ * reports as consumed has been completely dealt with, so you can
+ * simply call it again with the rest of the input.
+ * 
+ * Decoding errors in the input are translated into U+FFFD, which
+ * is then written into the output charset like any other
+ * character. If `error' is non-NULL and a character is found
+ * which cannot be expressed in the output charset, conversion will
+ * terminate just before the input byte which completed that
+ * character and `*error' will be set to TRUE; otherwise `*error'
+ * is set to FALSE. If `error' is NULL, difficult characters will
+ * simply be ignored.
+ * 
+ * If `input' is NULL, this routine will output the necessary
+ * bytes to reset the encoding state of the output charset, exactly
+ * as charset_from_unicode() would.
+ * 
+ * `output' may be NULL, and `outlen' may be negative, with the same
+ * meanings as for the routines above.
+ */
+
+int charset_convert(const char **input, int *inlen,
+		    char *output, int outlen,
+		    int srcset, charset_state *srcstate,
+		    int dstset, charset_state *dststate, int *error);
+
+/*
+ * Routines for callers who keep their text in UTF-8 rather than in
+ * wchar_t, which go straight between UTF-8 and another charset.
+ *
+ * charset_to_utf8() behaves exactly like charset_to_unicode_sz(),
+ * except that it writes the characters to `output' as UTF-8 and
+ * returns the number of bytes written; it will never write part of
+ * a character. `errstr' is a string of `errlen' bytes of UTF-8 to
+ * write for each conversion error, or NULL for the UTF-8 for
+ * U+FFFD. A character that UTF-8 can't represent (a surrogate,
+ * U+FFFE or U+FFFF) counts as an error. For single-byte charsets
+ * this is little more than a table lookup per byte, and converting
+ * valid UTF-8 to UTF-8 is a copy.
+ *
+ * charset_from_utf8() behaves like charset_from_unicode_sz(), but
+ * reads UTF-8 bytes; invalid UTF-8 is treated as U+FFFD, as
+ * charset_convert() does. It never consumes part of a UTF-8
+ * sequence: one which is cut off by the end of the input is left
+ * unread, so that you can pass it again with the rest of the
+ * input, and when conversion stops at an error `*input' points to
+ * the start of the offending sequence. If `input' is NULL, it
+ * outputs the bytes to reset the encoding state.
+ */
+size_t charset_to_utf8(const char **input, size_t *inlen,
+		       char *output, size_t outlen,
+		       int charset, charset_state *state,
+		       const char *errstr, size_t errlen);
+size_t charset_from_utf8(const char **input, size_t *inlen,
+			 char *output, size_t outlen,
+			 int charset, charset_state *state, int *error);
+
+/*
+ * Routines for callers who keep their text as UTF-16 code units in
+ * memory (as JavaScript engines and ICU do), whatever the size of
+ * wchar_t. A charset_char16 is one code unit; it has the same
+ * representation as C11's char16_t and ICU's UChar.
+ *
+ * charset_to_utf16units() behaves exactly like
+ * charset_to_unicode_sz(), except that characters outside the BMP
+ * are written as surrogate pairs, and the return value and
+ * `outlen' count code units. A pair is never split between calls.
+ * `errstr' is `errlen' code units to write for each conversion
+ * error, or NULL for U+FFFD. Decoding from UTF-16 itself (once any
+ * BOM has been dealt with) copies the code units straight across.
+ *
+ * charset_from_utf16units() behaves like charset_from_unicode_sz(),
+ * but reads code units, treating each surrogate pair as the
+ * character it stands for; an unpaired surrogate is passed to the
+ * output charset as it is, which will normally treat it as a
+ * character it can't express. It never consumes half a pair: a
+ * high surrogate at the very end of the input is left unread, so
+ * that you can pass it again with the rest of the input.
+ */
+typedef unsigned short charset_char16;
+
+size_t charset_to_utf16units(const char **input, size_t *inlen,
+			     charset_char16 *output, size_t outlen,
+			     int charset, charset_state *state,
+			     const charset_char16 *errstr, size_t errlen);
+size_t charset_from_utf16units(const charset_char16 **input, size_t *inlen,
+			       char *output, size_t outlen,
+			       int charset, charset_state *state,
+			       int *error);
+
+/*
+ * A charset_converter is a handle for doing a lot of conversions
+ * in one direction, e.g. decoding many small strings from the same
+ * charset. It looks up the charset(s) once, when it's created,
+ * rather than on every call, and it holds the conversion state
+ * itself so you don't have to.
+ * 
+ * charset_converter_new() makes a converter from `srcset' to
+ * `dstset'. Pass CS_NONE as one of them to make a converter to or
+ * from Unicode; pass real charsets for both to convert between
+ * them in the manner of charset_convert(). Returns NULL if either
+ * charset is unknown, or if both are CS_NONE, or if memory runs
+ * out.
+ * 
+ * Each of charset_converter_to_unicode(),
+ * charset_converter_from_unicode() and charset_converter_convert()
+ * behaves exactly like charset_to_unicode_sz(),
+ * charset_from_unicode_sz() and charset_convert() respectively,
+ * using the state held in the converter; which one you may call
+ * depends on what sort of converter you made.
+ * 
+ * charset_converter_reset() returns the converter to its initial
+ * state, discarding anything part-converted. (To _finish_ a piece
+ * of output cleanly, call the from_unicode or convert function
+ * with a NULL `input' first, as usual.)
+ */
+typedef struct charset_converter charset_converter;
+
+charset_converter *charset_converter_new(int srcset, int dstset);
+void charset_converter_free(charset_converter *conv);
+void charset_converter_reset(charset_converter *conv);
+size_t charset_converter_to_unicode(charset_converter *conv,
+				    const char **input, size_t *inlen,
+				    wchar_t *output, size_t outlen,
+				    const wchar_t *errstr, size_t errlen);
+size_t charset_converter_from_unicode(charset_converter *conv,
+				      const wchar_t **input, size_t *inlen,
+				      char *output, size_t outlen,
+				      int *error);
+size_t charset_converter_convert(charset_converter *conv,
+				 const char **input, size_t *inlen,
+				 char *output, size_t outlen, int *error);
+
+/*
+ * Normally, when an input unit produces more output than there's
+ * room for, the conversion functions stop just before it, and it
+ * is processed again from scratch on the next call. For charsets
+ * such as ISO-2022, where one input unit may produce an escape
+ * sequence and several characters, and with small output buffers,
+ * that can be a lot of wasted work.
+ * 
+ * Calling charset_converter_set_carry() with `carry' TRUE puts a
+ * converter into a mode where, instead, output which doesn't fit
+ * is kept in the converter and handed over at the start of the
+ * next call, so that every input unit is processed exactly once.
+ * In this mode, the output of one call may end part-way through a
+ * multibyte character or an error string; the concatenation of
+ * the outputs is what it would have been in one big call.
+ * charset_converter_pending() returns the number of units (bytes
+ * or wide characters) still waiting to be handed over; call again
+ * with no further input (`*inlen' zero) until it returns zero.
+ */
+void charset_converter_set_carry(charset_converter *conv, int carry);
+size_t charset_converter_pending(charset_converter const *conv);
+
 /*
  * Convert X11 encoding names to and from our charset identifiers.
  */
@@ -265,4 +899,73 @@ int charset_from_locale(void);
  */
 int charset_exists(int charset);
 
+/*
+ * This function fills in a structure describing the static
+ * capabilities of a charset, so that clients can size buffers and
+ * choose strategies without having to hard-code knowledge of
+ * individual encodings. It returns FALSE, and leaves the structure
+ * untouched, if the charset does not exist.
+ *
+ * The fields are:
+ *
+ *  - max_bytes_per_char is the largest number of bytes
+ *    charset_from_unicode() can output in order to encode a single
+ *    Unicode character. This includes any shift, escape or
+ *    byte-order-mark sequences which might have to precede the
+ *    character itself. So an output buffer of (max_bytes_per_char
+ *    * inlen) bytes will always be large enough, provided the
+ *    default error string (or no error string) is in use.
+ *
+ *  - max_reset_bytes is the largest number of bytes output when
+ *    charset_from_unicode() is called with input == NULL to reset
+ *    the encoding state.
+ *
+ *  - max_chars_per_byte is the largest number of Unicode
+ *    characters charset_to_unicode() can output in response to a
+ *    single input byte, counting each decoding error as one
+ *    character. If you supply an error string of more than one
+ *    character, multiply by its length.
+ *
+ *  - stateless is TRUE if the encoding state between any two
+ *    complete characters is always the same in both directions,
+ *    so that the input can be split at any character boundary
+ *    without having to carry state across the split.
+ *
+ *  - self_synchronising is TRUE if character boundaries can be
+ *    found by examining the bytes near a given position, without
+ *    having to decode the data from the start.
+ *
+ *  - ascii_superset is TRUE if the bytes 00-7F always represent
+ *    exactly the ASCII characters of the same values, and vice
+ *    versa. This is a stricter test than charset_contains_ascii()
+ *    above: it rules out ISO-2022 and UTF-16 and the like as well
+ *    as HZ and UTF-7.
+ *
+ *  - needs_reset is TRUE if a string of encoded output is not
+ *    properly terminated until charset_from_unicode() has been
+ *    called to reset the encoding state.
+ */
+struct charset_info {
+    int max_bytes_per_char;
+    int max_reset_bytes;
+    int max_chars_per_byte;
+    int stateless;
+    int self_synchronising;
+    int ascii_superset;
+    int needs_reset;
+};
+int charset_info(int charset, struct charset_info *info);
+
+/*
+ * This function returns the name of the set of CPU-specific code
+ * the library has chosen to scan its input with: "scalar", "sse2",
+ * "avx2" or "avx512". The choice is made once, from what the CPU
+ * supports, and can be overridden for testing by setting the
+ * environment variable LIBCHARSET_SIMD to one of those names before
+ * the library is first used. (If the CPU can't run the one named,
+ * the best one before it in that list is used instead; any other
+ * value selects "scalar".)
+ */
+const char *charset_simd_tier(void);
+
 #endif /* charset_charset_h */
@@ -0,0 +1,288 @@
+/*
+ * checkpoint.c - indexes of places in a large input where decoding
+ * can be restarted, which can also be used to translate between
+ * byte offsets and character positions; and a portable form of
+ * charset_state to keep them in.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * Decode (without output) from `*pos' to at least `target', and on
+ * until the decoder isn't part-way through a character, keeping
+ * `*state' and `*chars' up to date.
+ */
+static void advance(charset_spec const *spec, const char *input,
+		    size_t inlen, size_t target, size_t *pos,
+		    charset_state *state, size_t *chars,
+		    const wchar_t *errstr, size_t errlen)
+{
+    if (target > inlen)
+	target = inlen;
+    if (target > *pos) {
+	*chars += spec_measure_to_unicode(spec, input + *pos, target - *pos,
+					  state, errstr, errlen);
+	*pos = target;
+    }
+    while (*pos < inlen && spec->midchar && spec->midchar(spec, state)) {
+	*chars += spec_measure_to_unicode(spec, input + *pos, 1,
+					  state, errstr, errlen);
+	(*pos)++;
+    }
+}
+
+size_t charset_build_index(int charset, const char *input, size_t inlen,
+			   size_t interval,
+			   const wchar_t *errstr, size_t errlen,
+			   charset_checkpoint *index, size_t maxindex)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state state = CHARSET_INIT_STATE;
+    size_t pos = 0, chars = 0, n = 0;
+
+    if (interval == 0)
+	interval = 1;
+
+    while (1) {
+	if (n < maxindex) {
+	    index[n].offset = pos;
+	    index[n].chars = chars;
+	    index[n].state = state;    /* structure copy */
+	}
+	n++;
+
+	if (inlen - pos <= interval)
+	    break;
+	advance(spec, input, inlen, pos + interval, &pos, &state, &chars,
+		errstr, errlen);
+	if (pos >= inlen)
+	    break;
+    }
+
+    return n;
+}
+
+size_t charset_index_seek(int charset, const char *input, size_t inlen,
+			  const charset_checkpoint *index, size_t nindex,
+			  size_t offset,
+			  const wchar_t *errstr, size_t errlen,
+			  charset_state *state, size_t *chars)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state localstate = CHARSET_INIT_STATE;
+    size_t pos = 0, nchars = 0, lo, hi;
+
+    /*
+     * Find the last checkpoint at or before `offset'.
+     */
+    lo = 0;
+    hi = nindex;
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo) / 2;
+	if (index[mid].offset <= offset)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo > 0) {
+	pos = index[lo-1].offset;
+	nchars = index[lo-1].chars;
+	localstate = index[lo-1].state;	/* structure copy */
+    }
+
+    advance(spec, input, inlen, offset, &pos, &localstate, &nchars,
+	    errstr, errlen);
+
+    if (state)
+	*state = localstate;	       /* structure copy */
+    if (chars)
+	*chars = nchars;
+    return pos;
+}
+
+struct find_char {
+    size_t target, count;	       /* characters */
+    size_t offset;		       /* bytes */
+    int found;
+};
+
+static void find_char_sink(void *ctx, const wchar_t *chars,
+			   const size_t *offsets, size_t n)
+{
+    struct find_char *fc = (struct find_char *)ctx;
+
+    UNUSEDARG(chars);
+
+    if (!fc->found && fc->target < fc->count + n) {
+	fc->offset = offsets[fc->target - fc->count];
+	fc->found = TRUE;
+    }
+    fc->count += n;
+}
+
+size_t charset_index_char_offset(int charset, const char *input,
+				 size_t inlen,
+				 const charset_checkpoint *index,
+				 size_t nindex, size_t charpos,
+				 const wchar_t *errstr, size_t errlen)
+{
+    charset_state state = CHARSET_INIT_STATE;
+    struct find_char fc;
+    size_t start = 0, end = inlen, lo, hi;
+
+    /*
+     * Find the last checkpoint at or before the character. Since
+     * checkpoints are at character boundaries, the character must
+     * come from the bytes between that one and the next.
+     */
+    lo = 0;
+    hi = nindex;
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo) / 2;
+	if (index[mid].chars <= charpos)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    fc.target = charpos;
+    fc.count = 0;
+    if (lo > 0) {
+	start = index[lo-1].offset;
+	fc.count = index[lo-1].chars;
+	state = index[lo-1].state;     /* structure copy */
+    }
+    if (lo < nindex)
+	end = index[lo].offset;
+
+    /*
+     * Several checkpoints can share a character count, if there's
+     * input between them which produces no output (an escape
+     * sequence, say); but then we started from the last of them,
+     * which is the one nearest the character.
+     */
+    fc.found = FALSE;
+    charset_to_unicode_sink(input + start, end - start, charset, &state,
+			    errstr, errlen, find_char_sink, &fc);
+
+    return fc.found ? start + fc.offset : inlen;
+}
+
+void charset_state_serialise(charset_state const *state, unsigned char *buf)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	buf[i] = (unsigned char)(state->s0 >> (24 - 8*i));
+	buf[4+i] = (unsigned char)(state->s1 >> (24 - 8*i));
+    }
+}
+
+void charset_state_deserialise(charset_state *state, const unsigned char *buf)
+{
+    int i;
+
+    state->s0 = state->s1 = 0;
+    for (i = 0; i < 4; i++) {
+	state->s0 = (state->s0 << 8) | buf[i];
+	state->s1 = (state->s1 << 8) | buf[4+i];
+    }
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <string.h>
+
+int total_errs = 0;
+
+/*
+ * Index `input' every `interval' bytes, and then seek to every
+ * offset in it, checking that decoding the rest of the input from
+ * where the seek stopped gives exactly the tail of what decoding
+ * from the start gives.
+ */
+void seek_test(int line, int charset, const char *input, int inlen,
+	       int interval)
+{
+    static const wchar_t errstr[] = { '?' };
+    charset_checkpoint index[256];
+    wchar_t whole[1024], tail[1024];
+    charset_state state;
+    const char *p;
+    size_t nindex, n, nwhole, ntail, chars, pos;
+    int offset;
+
+    nindex = charset_build_index(charset, input, inlen, interval,
+				 errstr, lenof(errstr), index, lenof(index));
+    if (nindex > lenof(index)) {
+	printf("%d: index has %d entries\n", line, (int)nindex);
+	total_errs++;
+	return;
+    }
+
+    state = charset_init_state;
+    p = input;
+    n = inlen;
+    nwhole = charset_to_unicode_sz(&p, &n, whole, lenof(whole), charset,
+				   &state, errstr, lenof(errstr));
+
+    for (offset = 0; offset <= inlen; offset++) {
+	pos = charset_index_seek(charset, input, inlen, index, nindex,
+				 offset, errstr, lenof(errstr),
+				 &state, &chars);
+	if (pos < (size_t)offset || pos > (size_t)inlen || chars > nwhole) {
+	    printf("%d: seek to %d stopped at %d after %d chars\n",
+		   line, offset, (int)pos, (int)chars);
+	    total_errs++;
+	    continue;
+	}
+	p = input + pos;
+	n = inlen - pos;
+	ntail = charset_to_unicode_sz(&p, &n, tail, lenof(tail), charset,
+				      &state, errstr, lenof(errstr));
+	if (chars + ntail != nwhole ||
+	    memcmp(tail, whole + chars, ntail * sizeof(wchar_t))) {
+	    printf("%d: decoding after seek to %d gave the wrong text\n",
+		   line, offset);
+	    total_errs++;
+	}
+    }
+}
+
+/* Macro to concoct the first four parameters of seek_test. */
+#define TESTSTR(cs, x) __LINE__, cs, x, sizeof(x)-1
+
+int main(void)
+{
+    static const char iso2022jp[] =
+	"Japanese (\x1b$BF|K\\8l\x1b(B)\t"
+	"\x1b$B$3$s$K$A$O\x1b(B, "
+	"\x1b$B%3%s%K%A%O\x1b(B\n"
+	"\x1b$BF|K\\8l\x1b(B \x1b$BF|K\x1b(B \x1b$B$3$s$K$A$O\x1b(B\n";
+    static const char eucjp[] =
+	"Japanese (\xc6\xfc\xcb\xdc\xb8\xec)\t"
+	"\xa4\xb3\xa4\xf3\xa4\xcb\xa4\xc1\xa4\xcf, "
+	"\x8e\xba\x8e\xdd\x8e\xc6\x8e\xc1\x8e\xca\n"
+	"\xc6\xfc\xcb\xdc\xb8\n";
+    static const char utf8[] =
+	"\xCE\xBA\xE1\xBD\xB9\xCF\x83\xCE\xBC\xCE\xB5 \xE6\x97\xA5\xE6\x9C"
+	" \xF0\x9F\x98\x80\xC0\x80\n";
+    static const char utf7[] =
+	"Hi Mom -+Jjo--! A+ImIDkQ. +ZeVnLIqe-\n+AKM-1 +ZeVnLIq";
+    int interval;
+
+    printf("seek tests beginning\n");
+    for (interval = 1; interval <= 16; interval *= 2) {
+	seek_test(TESTSTR(CS_ISO2022_JP, iso2022jp), interval);
+	seek_test(TESTSTR(CS_EUC_JP, eucjp), interval);
+	seek_test(TESTSTR(CS_UTF8, utf8), interval);
+	seek_test(TESTSTR(CS_UTF7, utf7), interval);
+    }
+    printf("seek tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
@@ -0,0 +1,420 @@
+/*
+ * convert.c - convert directly from one charset to another.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * Size of the intermediate Unicode buffer. This is kept small
+ * enough to stay comfortably in cache while we round-trip through
+ * it.
+ */
+#define STAGELEN 1024
+
+/*
+ * Fused conversion from an SBCS to UTF-8, going straight from the
+ * SBCS table to the output without a Unicode buffer in between.
+ * Stops at anything it doesn't want to deal with (undefined bytes
+ * or running out of output space), and returns the number of bytes
+ * output.
+ */
+static size_t sbcs_to_utf8(const struct sbcs_data *sd,
+			   const char **input, size_t *inlen,
+			   char *output, size_t outlen)
+{
+    const unsigned char *p = (const unsigned char *)*input;
+    size_t i, n = *inlen, o = 0;
+
+    for (i = 0; i < n; i++) {
+	unsigned long c = sd->sbcs2ucs[p[i]];
+
+	if (c < 0x80) {
+	    if (o >= outlen)
+		break;
+	    output[o++] = c;
+	} else if (c < 0x800) {
+	    if (outlen - o < 2)
+		break;
+	    output[o++] = 0xC0 | (c >> 6);
+	    output[o++] = 0x80 | (c & 0x3F);
+	} else if (c < 0xFFFE && (c < 0xD800 || c >= 0xE000)) {
+	    if (outlen - o < 3)
+		break;
+	    output[o++] = 0xE0 | (c >> 12);
+	    output[o++] = 0x80 | ((c >> 6) & 0x3F);
+	    output[o++] = 0x80 | (c & 0x3F);
+	} else
+	    break;
+    }
+
+    *input += i;
+    *inlen -= i;
+    return o;
+}
+
+/*
+ * Fused conversion from UTF-8 to an SBCS. We only handle complete
+ * one-, two- and three-byte sequences here, and stop at anything
+ * else (including characters the SBCS can't represent) so that the
+ * general code can deal with it. `ascii' indicates that the SBCS
+ * maps ASCII to itself, so we needn't look those characters up.
+ */
+static size_t utf8_to_sbcs(const struct sbcs_data *sd, int ascii,
+			   const char **input, size_t *inlen,
+			   char *output, size_t outlen)
+{
+    const unsigned char *p = (const unsigned char *)*input;
+    size_t i = 0, n = *inlen, o = 0;
+
+    while (i < n && o < outlen) {
+	unsigned long c = p[i];
+	long int b;
+	size_t len;
+
+	if (c < 0x80) {
+	    len = 1;
+	} else if (c >= 0xC2 && c < 0xE0 && n - i >= 2 &&
+		   (p[i+1] & 0xC0) == 0x80) {
+	    c = ((c & 0x1F) << 6) | (p[i+1] & 0x3F);
+	    len = 2;
+	} else if (c >= 0xE0 && c < 0xF0 && n - i >= 3 &&
+		   (p[i+1] & 0xC0) == 0x80 && (p[i+2] & 0xC0) == 0x80) {
+	    c = ((c & 0x0F) << 12) | ((p[i+1] & 0x3F) << 6) | (p[i+2] & 0x3F);
+	    if (c < 0x800 || (c >= 0xD800 && c < 0xE000) || c >= 0xFFFE)
+		break;
+	    len = 3;
+	} else
+	    break;
+
+	if (ascii && c < 0x80)
+	    b = c;
+	else if ((b = sbcs_from_unicode(sd, c)) == ERROR)
+	    break;
+
+	output[o++] = b;
+	i += len;
+    }
+
+    *input += i;
+    *inlen -= i;
+    return o;
+}
+
+size_t spec_convert(charset_spec const *src, charset_spec const *dst,
+		    const char **input, size_t *inlen,
+		    char *output, size_t outlen,
+		    charset_state *srcstate, charset_state *dststate,
+		    int *error, struct charset_carry *carry)
+{
+    charset_state sstate = CHARSET_INIT_STATE;
+    charset_state dstate = CHARSET_INIT_STATE;
+    wchar_t stage[STAGELEN];
+    char trial[CARRYLEN];
+    size_t perbyte, bytewise = 0, writtenlen = 0;
+    int fused;
+
+    if (!input)
+	return spec_from_unicode(dst, NULL, NULL, output, outlen,
+				 dststate, NULL, carry);
+
+    if (srcstate)
+	sstate = *srcstate;	       /* structure copy */
+    if (dststate)
+	dstate = *dststate;	       /* structure copy */
+    if (error)
+	*error = FALSE;
+
+    /*
+     * The most output we can generate in response to one byte of
+     * input. If we only convert as many input bytes as the output
+     * buffer has room for at this rate, we can be sure that the
+     * conversion will fit, and we needn't worry about unpicking a
+     * half-finished job.
+     */
+    perbyte = src->maxchars * dst->maxbytes;
+    assert(perbyte <= sizeof(trial));
+
+    /*
+     * See whether we have a fused fast path for this pair.
+     */
+    if (!output)
+	fused = 0;
+    else if (src->read == read_sbcs && dst->charset == CS_UTF8)
+	fused = 1;
+    else if (src->charset == CS_UTF8 && dst->read == read_sbcs)
+	fused = 2;
+    else
+	fused = 0;
+
+    while (*inlen > 0) {
+	const char *inptr;
+	const wchar_t *stageptr;
+	charset_state s, d;
+	char *target;
+	size_t n, len, ret;
+	int err;
+
+	if (fused && !bytewise) {
+	    if (fused == 1)
+		ret = sbcs_to_utf8(src->data, input, inlen, output, outlen);
+	    else if (sstate.s0 == 0)
+		ret = utf8_to_sbcs(dst->data, dst->flags & CSF_ASCII,
+				   input, inlen, output, outlen);
+	    else
+		ret = 0;
+	    output += ret;
+	    if (outlen != CHARSET_UNBOUNDED)
+		outlen -= ret;
+	    writtenlen += ret;
+	    if (srcstate)
+		*srcstate = sstate;    /* structure copy */
+	    if (*inlen == 0)
+		break;
+	}
+
+	/*
+	 * Decide how much input to convert in one go. If the fused
+	 * path has just given up on something, we only hand the
+	 * general code one byte before letting the fused path have
+	 * another go.
+	 */
+	n = (bytewise || fused ? 1 : STAGELEN / src->maxchars);
+	if (n > *inlen)
+	    n = *inlen;
+	if (outlen != CHARSET_UNBOUNDED && n > outlen / perbyte)
+	    n = outlen / perbyte;
+
+	if (n > 0) {
+	    target = output;
+	} else {
+	    /*
+	     * We're too near the end of the output buffer to be
+	     * sure one more byte of input will fit. Convert it into
+	     * a spare buffer and see.
+	     */
+	    n = 1;
+	    target = trial;
+	}
+
+	s = sstate;		       /* structure copy */
+	d = dstate;		       /* structure copy */
+	inptr = *input;
+	ret = n;
+	len = spec_to_unicode(src, &inptr, &ret, stage, lenof(stage),
+			      &s, NULL, 0, NULL, NULL, NULL, NULL, NULL);
+	assert(ret == 0);
+	stageptr = stage;
+	err = FALSE;
+	ret = spec_from_unicode(dst, &stageptr, &len, target,
+				(target == trial ? sizeof(trial) : outlen),
+				&d, error ? &err : NULL, NULL);
+	assert(len == 0 || err);
+
+	if (err) {
+	    if (n > 1) {
+		/*
+		 * Somewhere in this block is a character the output
+		 * charset can't represent. Throw the block away and
+		 * go over it again a byte at a time, so that we stop
+		 * at exactly the right place.
+		 */
+		bytewise = n;
+		continue;
+	    }
+	    *error = TRUE;
+	    break;
+	}
+
+	if (target == trial) {
+	    if (outlen != CHARSET_UNBOUNDED && ret > outlen) {
+		if (!carry)
+		    break;	       /* it didn't fit */
+		/*
+		 * Keep the part that didn't fit in the carry buffer.
+		 */
+		assert(ret <= CARRYLEN);
+		memcpy(carry->buf, trial + outlen, ret - outlen);
+		carry->len = ret - outlen;
+		ret = outlen;
+	    }
+	    if (output)
+		memcpy(output, trial, ret);
+	}
+
+	/*
+	 * Commit to what we've just done.
+	 */
+	if (output)
+	    output += ret;
+	if (outlen != CHARSET_UNBOUNDED)
+	    outlen -= ret;
+	writtenlen += ret;
+	*input = inptr;
+	*inlen -= n;
+	sstate = s;		       /* structure copy */
+	dstate = d;		       /* structure copy */
+	if (srcstate)
+	    *srcstate = sstate;	       /* structure copy */
+	if (dststate)
+	    *dststate = dstate;	       /* structure copy */
+	if (bytewise > 0)
+	    bytewise--;
+	if (carry && carry->len)
+	    break;		       /* output buffer is full */
+    }
+
+    return writtenlen;
+}
+
+int charset_convert(const char **input, int *inlen,
+		    char *output, int outlen,
+		    int srcset, charset_state *srcstate,
+		    int dstset, charset_state *dststate, int *error)
+{
+    charset_spec const *src = charset_find_spec(srcset);
+    charset_spec const *dst = charset_find_spec(dstset);
+    size_t len, ret;
+
+    if (!input)
+	return spec_convert(src, dst, NULL, NULL, output,
+			    (outlen < 0 ? CHARSET_UNBOUNDED : (size_t)outlen),
+			    srcstate, dststate, error, NULL);
+
+    if (error)
+	*error = FALSE;
+    if (*inlen <= 0)
+	return 0;
+
+    len = *inlen;
+    ret = spec_convert(src, dst, input, &len, output,
+		       (outlen < 0 ? CHARSET_UNBOUNDED : (size_t)outlen),
+		       srcstate, dststate, error, NULL);
+    *inlen = len;
+    return ret;
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+
+int total_errs = 0;
+
+/*
+ * Convert `input' from `src' to `dst' with an output buffer of only
+ * `outchunk' bytes at a time, and check that the output, the
+ * error flag and where in the input we stopped are exactly what
+ * the chained path gives when driven by hand a byte at a time.
+ */
+void convert_test(int line, int srcset, int dstset,
+		  const char *input, size_t inlen, size_t outchunk)
+{
+    charset_spec const *src = charset_find_spec(srcset);
+    charset_spec const *dst = charset_find_spec(dstset);
+    charset_state s = CHARSET_INIT_STATE, d = CHARSET_INIT_STATE;
+    char out1[1024], out2[1024], chunk[16];
+    wchar_t wide[16];
+    const char *p;
+    const wchar_t *q;
+    size_t i, n, wlen, len1 = 0, len2 = 0, stop2 = inlen;
+    int err1 = FALSE, err2 = FALSE;
+
+    for (i = 0; i < inlen; i++) {
+	p = input + i;
+	n = 1;
+	wlen = spec_to_unicode(src, &p, &n, wide, lenof(wide), &s,
+			       NULL, 0, NULL, NULL, NULL, NULL, NULL);
+	q = wide;
+	len2 += spec_from_unicode(dst, &q, &wlen, out2 + len2,
+				  sizeof(out2) - len2, &d, &err2, NULL);
+	if (err2) {
+	    stop2 = i;
+	    break;
+	}
+    }
+
+    s = d = charset_init_state;
+    p = input;
+    n = inlen;
+    while (n > 0) {
+	size_t ret, before = n;
+
+	if (!outchunk) {
+	    ret = spec_convert(src, dst, &p, &n, out1 + len1,
+			       CHARSET_UNBOUNDED, &s, &d, &err1, NULL);
+	} else {
+	    /*
+	     * Write into a buffer with something after it, so we
+	     * notice if outlen isn't respected.
+	     */
+	    memset(chunk, '*', sizeof(chunk));
+	    ret = spec_convert(src, dst, &p, &n, chunk, outchunk,
+			       &s, &d, &err1, NULL);
+	    if (ret > outchunk || chunk[outchunk] != '*') {
+		printf("%d (outchunk %d): overran output buffer\n",
+		       line, (int)outchunk);
+		total_errs++;
+		return;
+	    }
+	    memcpy(out1 + len1, chunk, ret);
+	}
+	len1 += ret;
+	if (err1 || (ret == 0 && n == before))
+	    break;
+    }
+
+    if (len1 != len2 || memcmp(out1, out2, len1)) {
+	printf("%d (outchunk %d): output differs\n", line, (int)outchunk);
+	total_errs++;
+    }
+    if (err1 != err2 || (size_t)(p - input) != stop2) {
+	printf("%d (outchunk %d): stopped at %d (error %d), "
+	       "expected %d (error %d)\n", line, (int)outchunk,
+	       (int)(p - input), err1, (int)stop2, err2);
+	total_errs++;
+    }
+}
+
+/* Macro to concoct the first five parameters of convert_test. */
+#define TESTSTR(src, dst, x) __LINE__, src, dst, x, sizeof(x)-1
+
+int main(void)
+{
+    /* U+20AC and U+2122 are in CP1252 only; U+0451 is in KOI8-R only. */
+    static const char utf8[] =
+	"caf\xC3\xA9 \xE2\x82\xAC" "5 \xE2\x84\xA2 \xD1\x91 \xC2\xA0"
+	"\xF0\x9F\x98\x80 \xC0\x80 \xED\xA0\x80 \xFF\xE2\x82 end\n";
+    static const char utf8bad[] = "abc\xE2\x80\"\xC3\xA9\xE2\x82";
+    static const char utf8first[] = "\xE2\x82\xAC" "abc";
+    char sbcs[256];
+    size_t outchunk;
+    int i;
+
+    for (i = 0; i < 256; i++)
+	sbcs[i] = 255 - i;
+
+    printf("convert tests beginning\n");
+    for (outchunk = 0; outchunk <= 8; outchunk++) {
+	if (outchunk == 1 || outchunk == 2)
+	    continue;		       /* too small for a 3-byte character */
+	convert_test(__LINE__, CS_ISO8859_1, CS_UTF8, sbcs, 256, outchunk);
+	convert_test(__LINE__, CS_CP1252, CS_UTF8, sbcs, 256, outchunk);
+	convert_test(__LINE__, CS_KOI8_R, CS_UTF8, sbcs, 256, outchunk);
+    }
+    for (outchunk = 0; outchunk <= 8; outchunk++) {
+	convert_test(TESTSTR(CS_UTF8, CS_ISO8859_1, utf8), outchunk);
+	convert_test(TESTSTR(CS_UTF8, CS_CP1252, utf8), outchunk);
+	convert_test(TESTSTR(CS_UTF8, CS_KOI8_R, utf8), outchunk);
+	convert_test(TESTSTR(CS_UTF8, CS_ISO8859_1, utf8first), outchunk);
+	convert_test(TESTSTR(CS_UTF8, CS_CP1252, utf8bad), outchunk);
+    }
+    printf("convert tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
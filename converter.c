@@ -0,0 +1,306 @@
+/*
+ * converter.c - long-lived conversion handles.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "charset.h"
+#include "internal.h"
+
+struct charset_converter {
+    /*
+     * The specs for each side of the conversion, looked up once
+     * and for all when the converter is created. NULL means that
+     * side is Unicode.
+     */
+    charset_spec const *src, *dst;
+    charset_state srcstate, dststate;
+
+    /*
+     * Output which didn't fit in the caller's buffer last time, if
+     * we're in carry mode. Only one of these is used, depending on
+     * whether the output side is Unicode.
+     */
+    int use_carry;
+    struct unicode_carry wcarry;
+    struct charset_carry carry;
+};
+
+/*
+ * Hand on as much of the carry buffer as will fit in the output.
+ * Returns the number of units output.
+ */
+static size_t drain_unicode(struct unicode_carry *carry,
+			    wchar_t **output, size_t *outlen)
+{
+    size_t n = carry->len - carry->pos;
+
+    if (*outlen != CHARSET_UNBOUNDED && n > *outlen)
+	n = *outlen;
+    if (*output) {
+	memcpy(*output, carry->buf + carry->pos, n * sizeof(wchar_t));
+	*output += n;
+    }
+    if (*outlen != CHARSET_UNBOUNDED)
+	*outlen -= n;
+    carry->pos += n;
+    if (carry->pos == carry->len)
+	carry->pos = carry->len = 0;
+    return n;
+}
+
+static size_t drain_charset(struct charset_carry *carry,
+			    char **output, size_t *outlen)
+{
+    size_t n = carry->len - carry->pos;
+
+    if (*outlen != CHARSET_UNBOUNDED && n > *outlen)
+	n = *outlen;
+    if (*output) {
+	memcpy(*output, carry->buf + carry->pos, n);
+	*output += n;
+    }
+    if (*outlen != CHARSET_UNBOUNDED)
+	*outlen -= n;
+    carry->pos += n;
+    if (carry->pos == carry->len)
+	carry->pos = carry->len = 0;
+    return n;
+}
+
+charset_converter *charset_converter_new(int srcset, int dstset)
+{
+    charset_converter *conv;
+    charset_spec const *src = NULL, *dst = NULL;
+
+    if (srcset != CS_NONE && (src = charset_find_spec(srcset)) == NULL)
+	return NULL;
+    if (dstset != CS_NONE && (dst = charset_find_spec(dstset)) == NULL)
+	return NULL;
+    if (!src && !dst)
+	return NULL;
+
+    conv = (charset_converter *)malloc(sizeof(charset_converter));
+    if (!conv)
+	return NULL;
+    conv->src = src;
+    conv->dst = dst;
+    conv->use_carry = FALSE;
+    charset_converter_reset(conv);
+    return conv;
+}
+
+void charset_converter_free(charset_converter *conv)
+{
+    free(conv);
+}
+
+void charset_converter_reset(charset_converter *conv)
+{
+    conv->srcstate = charset_init_state;   /* structure copy */
+    conv->dststate = charset_init_state;   /* structure copy */
+    conv->wcarry.pos = conv->wcarry.len = 0;
+    conv->carry.pos = conv->carry.len = 0;
+}
+
+void charset_converter_set_carry(charset_converter *conv, int carry)
+{
+    conv->use_carry = carry;
+}
+
+size_t charset_converter_pending(charset_converter const *conv)
+{
+    if (conv->dst)
+	return conv->carry.len - conv->carry.pos;
+    else
+	return conv->wcarry.len - conv->wcarry.pos;
+}
+
+size_t charset_converter_to_unicode(charset_converter *conv,
+				    const char **input, size_t *inlen,
+				    wchar_t *output, size_t outlen,
+				    const wchar_t *errstr, size_t errlen)
+{
+    size_t done;
+
+    assert(conv->src && !conv->dst);
+
+    done = drain_unicode(&conv->wcarry, &output, &outlen);
+    if (conv->wcarry.len)
+	return done;
+
+    return done + spec_to_unicode(conv->src, input, inlen, output, outlen,
+				  &conv->srcstate, errstr, errlen, NULL, NULL,
+				  NULL, NULL,
+				  conv->use_carry ? &conv->wcarry : NULL);
+}
+
+size_t charset_converter_from_unicode(charset_converter *conv,
+				      const wchar_t **input, size_t *inlen,
+				      char *output, size_t outlen,
+				      int *error)
+{
+    size_t done;
+
+    assert(!conv->src && conv->dst);
+
+    if (error)
+	*error = FALSE;
+    done = drain_charset(&conv->carry, &output, &outlen);
+    if (conv->carry.len)
+	return done;
+
+    return done + spec_from_unicode(conv->dst, input, inlen, output, outlen,
+				    &conv->dststate, error,
+				    conv->use_carry ? &conv->carry : NULL);
+}
+
+size_t charset_converter_convert(charset_converter *conv,
+				 const char **input, size_t *inlen,
+				 char *output, size_t outlen, int *error)
+{
+    size_t done;
+
+    assert(conv->src && conv->dst);
+
+    if (error)
+	*error = FALSE;
+    done = drain_charset(&conv->carry, &output, &outlen);
+    if (conv->carry.len)
+	return done;
+
+    return done + spec_convert(conv->src, conv->dst, input, inlen,
+			       output, outlen, &conv->srcstate,
+			       &conv->dststate, error,
+			       conv->use_carry ? &conv->carry : NULL);
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+
+int total_errs = 0;
+
+/*
+ * Feed `input' to a converter in carry mode `inchunk' bytes (or
+ * characters) at a time, with an output buffer of only `outchunk'
+ * units, and check that the concatenated output is exactly what
+ * one big call with plenty of room gives.
+ */
+void carry_test(int line, int srcset, int dstset, const char *input,
+		int inlen, int inchunk, int outchunk)
+{
+    charset_converter *conv = charset_converter_new(srcset, dstset);
+    charset_state st1 = CHARSET_INIT_STATE, st2 = CHARSET_INIT_STATE;
+    wchar_t wide[1024], wout[1024];
+    char out1[4096], out2[4096];
+    const char *p;
+    const wchar_t *q;
+    size_t n, len1 = 0, len2, wlen;
+    int pos, ilen;
+
+    charset_converter_set_carry(conv, TRUE);
+
+    /*
+     * The Unicode side of the conversion (if either) is what
+     * `input' decodes to in `srcset', or in UTF-8 if that's the
+     * Unicode side.
+     */
+    p = input;
+    n = inlen;
+    wlen = charset_to_unicode_sz(&p, &n, wide, lenof(wide),
+				 srcset == CS_NONE ? CS_UTF8 : srcset,
+				 NULL, NULL, 0);
+
+    if (dstset == CS_NONE) {
+	len2 = wlen;
+	for (pos = 0; pos < inlen; pos += inchunk) {
+	    p = input + pos;
+	    n = (inlen - pos < inchunk ? inlen - pos : inchunk);
+	    do {
+		len1 += charset_converter_to_unicode(conv, &p, &n,
+						     wout + len1, outchunk,
+						     NULL, 0);
+	    } while (n > 0 || charset_converter_pending(conv) > 0);
+	}
+	if (len1 != len2 || memcmp(wout, wide, len1 * sizeof(wchar_t))) {
+	    printf("%d: carried output differs\n", line);
+	    total_errs++;
+	}
+    } else {
+	if (srcset == CS_NONE) {
+	    q = wide;
+	    n = wlen;
+	    len2 = charset_from_unicode_sz(&q, &n, out2, sizeof(out2),
+					   dstset, &st2, NULL);
+	    inlen = wlen;
+	} else {
+	    ilen = inlen;
+	    p = input;
+	    len2 = charset_convert(&p, &ilen, out2, sizeof(out2),
+				   srcset, &st1, dstset, &st2, NULL);
+	}
+	for (pos = 0; pos < inlen; pos += inchunk) {
+	    n = (inlen - pos < inchunk ? inlen - pos : inchunk);
+	    p = input + pos;
+	    q = wide + pos;
+	    do {
+		if (srcset == CS_NONE)
+		    len1 += charset_converter_from_unicode(conv, &q, &n,
+							   out1 + len1,
+							   outchunk, NULL);
+		else
+		    len1 += charset_converter_convert(conv, &p, &n,
+						      out1 + len1,
+						      outchunk, NULL);
+	    } while (n > 0 || charset_converter_pending(conv) > 0);
+	}
+	if (len1 != len2 || memcmp(out1, out2, len1)) {
+	    printf("%d: carried output differs\n", line);
+	    total_errs++;
+	}
+    }
+
+    charset_converter_free(conv);
+}
+
+/* Macro to concoct the first five parameters of carry_test. */
+#define TESTSTR(src, dst, x) __LINE__, src, dst, x, sizeof(x)-1
+
+int main(void)
+{
+    static const char iso2022jp[] =
+	"Japanese (\x1b$BF|K\\8l\x1b(B)\t"
+	"\x1b$B$3$s$K$A$O\x1b(B, "
+	"\x1b$B%3%s%K%A%O\x1b(B\n\x1b$BF|\x1b(B";
+    static const char utf8[] =
+	"\xCE\xBA\xE1\xBD\xB9\xCF\x83\xCE\xBC\xCE\xB5 \xE6\x97\xA5\xE6\x9C"
+	" \xF0\x9F\x98\x80\xC0\x80\n";
+    int inchunk, outchunk;
+
+    printf("carry tests beginning\n");
+    for (inchunk = 1; inchunk <= 64; inchunk *= 4) {
+	for (outchunk = 1; outchunk <= 5; outchunk++) {
+	    carry_test(TESTSTR(CS_ISO2022_JP, CS_NONE, iso2022jp),
+		       inchunk, outchunk);
+	    carry_test(TESTSTR(CS_UTF8, CS_NONE, utf8),
+		       inchunk, outchunk);
+	    carry_test(TESTSTR(CS_NONE, CS_ISO2022_JP, utf8),
+		       inchunk, outchunk);
+	    carry_test(TESTSTR(CS_NONE, CS_UTF7, utf8),
+		       inchunk, outchunk);
+	    carry_test(TESTSTR(CS_ISO2022_JP, CS_UTF8, iso2022jp),
+		       inchunk, outchunk);
+	    carry_test(TESTSTR(CS_UTF8, CS_ISO2022_JP, utf8),
+		       inchunk, outchunk);
+	}
+    }
+    printf("carry tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
@@ -8,7 +8,8 @@
 #include "internal.h"
 
 /*
- * CP949 has no associated data, so `charset' may be ignored.
+ * The CP949 read and write functions need no associated data (the
+ * spec's data is for dbcs.c), so `charset' may be ignored.
  */
 
 static void read_cp949(charset_spec const *charset, long int input_chr,
@@ -50,6 +51,11 @@ static void read_cp949(charset_spec const *charset, long int input_chr,
     }
 }
 
+/* CP949 lead bytes are 81-FE, for the shared functions in dbcs.c. */
+static const struct dbcs_data cp949_data = {
+    { 0, 0, 0, 0, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0x7FFFFFFF }
+};
+
 /*
  * CP949 is a stateless multi-byte encoding (in the sense that just
  * after any character has been completed, the state is always the
@@ -84,7 +90,9 @@ static int write_cp949(charset_spec const *charset, long int input_chr,
 }
 
 const charset_spec charset_CS_CP949 = {
-    CS_CP949, read_cp949, write_cp949, NULL
+    CS_CP949, read_cp949, write_cp949, &cp949_data,
+    NULL, NULL, read_dbcs_count, NULL, midchar_dbcs, NULL, sync_dbcs,
+    2, 0, 1, CSF_STATELESS | CSF_ASCII
 };
 
 #else /* ENUM_CHARSETS */
@@ -0,0 +1,78 @@
+/*
+ * dbcs.c - routines shared by the simple double-byte encodings.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * In Big5, CP949 and Shift-JIS, a lead byte always swallows the
+ * byte after it, valid or not, and produces one character or
+ * error; anything else produces one on its own. The charset_spec
+ * for such an encoding should have a struct dbcs_data saying which
+ * bytes are lead bytes as its `data' field, and can then use the
+ * functions here.
+ */
+
+/*
+ * Counting version of the read function. Unless errors are an
+ * unusual length, all we have to do is spot lead bytes.
+ */
+size_t read_dbcs_count(charset_spec const *charset,
+		       const char **input, size_t *inlen,
+		       charset_state *state, size_t errlen)
+{
+    const struct dbcs_data *dd = charset->data;
+    const unsigned char *p = (const unsigned char *)*input;
+    const unsigned char *end = p + *inlen;
+    size_t count = 0;
+
+    if (state->s0 != 0 || errlen != 1)
+	return 0;
+
+    while (p < end) {
+	if (DBCS_LEAD(dd, *p)) {
+	    if (end - p < 2)
+		break;		       /* leave it for the read function */
+	    p += 2;
+	} else
+	    p++;
+	count++;
+    }
+
+    *inlen -= p - (const unsigned char *)*input;
+    *input = (const char *)p;
+    return count;
+}
+
+/*
+ * The read function is part-way through a character when it has a
+ * lead byte stored.
+ */
+int midchar_dbcs(charset_spec const *charset, charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return state->s0 != 0;
+}
+
+/*
+ * A byte which isn't a lead byte either completes a double-byte
+ * character or stands on its own, so after one the state is zero.
+ */
+size_t sync_dbcs(charset_spec const *charset,
+		 const unsigned char *input, size_t inlen, size_t pos,
+		 charset_state *state)
+{
+    const struct dbcs_data *dd = charset->data;
+
+    if (pos == 0)
+	pos = 1;
+    for (; pos < inlen; pos++) {
+	if (!DBCS_LEAD(dd, input[pos-1])) {
+	    state->s0 = 0;
+	    return pos;
+	}
+    }
+    return inlen;
+}
@@ -86,6 +86,41 @@ static void read_euc(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * read_euc is part-way through a character exactly when its state
+ * is nonzero.
+ */
+static int midchar_euc(charset_spec const *charset,
+		       charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return state->s0 != 0;
+}
+
+/*
+ * After any byte which neither begins nor continues a multibyte
+ * character, read_euc's state is zero whatever it was before.
+ */
+static size_t sync_euc(charset_spec const *charset,
+		      const unsigned char *input, size_t inlen, size_t pos,
+		      charset_state *state)
+{
+    UNUSEDARG(charset);
+
+    if (pos == 0)
+	pos = 1;
+    for (; pos < inlen; pos++) {
+	unsigned c = input[pos-1];
+
+	if ((c < 0xA1 && c != 0x8E && c != 0x8F) || c == 0xFF) {
+	    state->s0 = 0;
+	    return pos;
+	}
+    }
+    return inlen;
+}
+
 /*
  * All EUCs are stateless multi-byte encodings (in the sense that
  * just after any character has been completed, the state is always
@@ -129,6 +164,180 @@ static int write_euc(charset_spec const *charset, long int input_chr,
     return TRUE;
 }
 
+/*
+ * Block versions of read_euc and write_euc, which handle complete
+ * characters only and leave errors and split characters to the
+ * functions above.
+ */
+static size_t read_euc_block(charset_spec const *charset,
+			     const char **input, size_t *inlen,
+			     charset_state *state, wchar_t *output,
+			     size_t outlen)
+{
+    struct euc const *euc = (struct euc *)charset->data;
+    const unsigned char *p = (const unsigned char *)*input;
+    const unsigned char *end = p + *inlen;
+    size_t i;
+    int cset, n, j;
+    unsigned long acc;
+    long int ucs;
+
+    if (state->s0 != 0)
+	return 0;
+
+    i = 0;
+    while (i < outlen && p < end) {
+	if (*p < 0x80) {
+	    i += ascii_widen(&p, end - p, output + i, outlen - i);
+	    continue;
+	}
+
+	/*
+	 * Work out which of the three multibyte sections we're in,
+	 * and where its GR bytes start.
+	 */
+	if (*p == 0x8E || *p == 0x8F) {
+	    cset = *p - 0x8C;
+	    j = 1;
+	} else if (*p >= 0xA1 && *p != 0xFF) {
+	    cset = 1;
+	    j = 0;
+	} else
+	    break;		       /* error byte */
+
+	n = euc->nchars[cset-1];
+	if (n == 0 || end - p < j + n)
+	    break;		       /* invalid section, or incomplete */
+
+	/*
+	 * Accumulate the GR bytes exactly as read_euc does.
+	 */
+	acc = 0;
+	for (; n > 0; n--, j++) {
+	    if (p[j] < 0xA1 || p[j] == 0xFF)
+		break;
+	    acc = ((acc & 0xFFFF) << 8) | p[j];
+	}
+	if (n > 0)
+	    break;
+
+	ucs = euc->to_ucs(((unsigned long)cset << 28) |
+			  ((unsigned long)euc->nchars[cset-1] << 24) | acc);
+	if (ucs == ERROR)
+	    break;
+
+	output[i++] = ucs;
+	p += j;
+    }
+
+    *inlen -= p - (const unsigned char *)*input;
+    *input = (const char *)p;
+    return i;
+}
+
+static size_t write_euc_block(charset_spec const *charset,
+			      const wchar_t **input, size_t *inlen,
+			      charset_state *state, char *output,
+			      size_t outlen)
+{
+    struct euc const *euc = (struct euc *)charset->data;
+    const wchar_t *p = *input, *end = p + *inlen;
+    size_t o = 0;
+    int cset, len;
+    unsigned long c;
+
+    UNUSEDARG(state);
+
+    while (p < end) {
+	if (*p < 0)
+	    break;
+
+	if (*p < 0x80) {
+	    if (outlen - o < 1) break;
+	    o += ascii_narrow(&p, end - p, output + o, outlen - o);
+	    continue;
+	}
+
+	c = euc->from_ucs(*p);
+	if (!c)
+	    break;
+
+	cset = c >> 28;
+	len = euc->nchars[cset-1];
+	c &= 0xFFFFFF;
+	if (outlen - o < (size_t)(len + (cset > 1)))
+	    break;
+
+	if (cset > 1)
+	    output[o++] = 0x8C + cset; /* SS2/SS3 */
+	while (len--)
+	    output[o++] = (c >> (8*len)) & 0xFF;
+	p++;
+    }
+
+    *inlen -= p - *input;
+    *input = p;
+    return o;
+}
+
+/*
+ * Counting version of read_euc. Each complete multibyte character
+ * produces exactly one output character (or error), and so does
+ * each incomplete one cut short by a non-GR byte, so as long as
+ * errors are one character long we needn't consult the mapping
+ * tables at all.
+ */
+static size_t read_euc_count(charset_spec const *charset,
+			     const char **input, size_t *inlen,
+			     charset_state *state, size_t errlen)
+{
+    struct euc const *euc = (struct euc *)charset->data;
+    const unsigned char *p = (const unsigned char *)*input;
+    const unsigned char *end = p + *inlen;
+    size_t count = 0;
+    int j, n;
+
+    if (state->s0 != 0 || errlen != 1)
+	return 0;
+
+    while (p < end) {
+	if (*p < 0x80 || (*p < 0xA1 && *p != 0x8E && *p != 0x8F) ||
+	    *p == 0xFF) {
+	    p++;		       /* ASCII, or error byte */
+	    count++;
+	    continue;
+	}
+
+	/*
+	 * Start of a multibyte character: find out how many GR
+	 * bytes should follow.
+	 */
+	if (*p == 0x8E || *p == 0x8F)
+	    n = euc->nchars[*p - 0x8D];
+	else
+	    n = euc->nchars[0] - 1;
+
+	for (j = 1; j <= n; j++) {
+	    if (p + j >= end)
+		goto done;	       /* leave it for read_euc */
+	    if (p[j] < 0xA1 || p[j] == 0xFF)
+		break;		       /* cut short */
+	}
+
+	/*
+	 * Either way, that's one character or error, and we carry
+	 * on from the first byte we haven't swallowed.
+	 */
+	count++;
+	p += j;
+    }
+
+  done:
+    *inlen -= p - (const unsigned char *)*input;
+    *input = (const char *)p;
+    return count;
+}
+
 /*
  * EUC-CN encodes GB2312 only.
  */
@@ -152,7 +361,10 @@ static const struct euc euc_cn = {
     {2,0,0}, euc_cn_to_ucs, euc_cn_from_ucs
 };
 const charset_spec charset_CS_EUC_CN = {
-    CS_EUC_CN, read_euc, write_euc, &euc_cn
+    CS_EUC_CN, read_euc, write_euc, &euc_cn,
+    read_euc_block, write_euc_block, read_euc_count, NULL, midchar_euc,
+    NULL, sync_euc,
+    2, 0, 2, CSF_STATELESS | CSF_ASCII
 };
 
 /*
@@ -178,7 +390,10 @@ static const struct euc euc_kr = {
     {2,0,0}, euc_kr_to_ucs, euc_kr_from_ucs
 };
 const charset_spec charset_CS_EUC_KR = {
-    CS_EUC_KR, read_euc, write_euc, &euc_kr
+    CS_EUC_KR, read_euc, write_euc, &euc_kr,
+    read_euc_block, write_euc_block, read_euc_count, NULL, midchar_euc,
+    NULL, sync_euc,
+    2, 0, 2, CSF_STATELESS | CSF_ASCII
 };
 
 /*
@@ -223,7 +438,10 @@ static const struct euc euc_jp = {
     {2,1,2}, euc_jp_to_ucs, euc_jp_from_ucs
 };
 const charset_spec charset_CS_EUC_JP = {
-    CS_EUC_JP, read_euc, write_euc, &euc_jp
+    CS_EUC_JP, read_euc, write_euc, &euc_jp,
+    read_euc_block, write_euc_block, read_euc_count, NULL, midchar_euc,
+    NULL, sync_euc,
+    3, 0, 2, CSF_STATELESS | CSF_ASCII
 };
 
 /*
@@ -259,7 +477,10 @@ static const struct euc euc_tw = {
     {2,3,0}, euc_tw_to_ucs, euc_tw_from_ucs
 };
 const charset_spec charset_CS_EUC_TW = {
-    CS_EUC_TW, read_euc, write_euc, &euc_tw
+    CS_EUC_TW, read_euc, write_euc, &euc_tw,
+    read_euc_block, write_euc_block, read_euc_count, NULL, midchar_euc,
+    NULL, sync_euc,
+    4, 0, 2, CSF_STATELESS | CSF_ASCII
 };
 
 #else /* ENUM_CHARSETS */
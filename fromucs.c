@@ -7,9 +7,10 @@
 
 struct charset_emit_param {
     char *output;
-    int outlen;
-    int writtenlen;
+    size_t outlen;
+    size_t writtenlen;
     int stopped;
+    struct charset_carry *carry;
 };
 
 static void charset_emit(void *ctx, long int output)
@@ -19,22 +20,37 @@ static void charset_emit(void *ctx, long int output)
     if (param->outlen != 0) {
 	if (param->output)
 	    *param->output++ = output;
-	if (param->outlen > 0)
+	if (param->outlen != CHARSET_UNBOUNDED)
 	    param->outlen--;
 	param->writtenlen++;
+    } else if (param->carry && param->carry->len < CARRYLEN) {
+	param->carry->buf[param->carry->len++] = output;
     } else {
 	param->stopped = 1;
     }
 }
 
-int charset_from_unicode(const wchar_t **input, int *inlen,
-			 char *output, int outlen,
-			 int charset, charset_state *state, int *error)
+size_t spec_from_unicode(charset_spec const *spec,
+			 const wchar_t **input, size_t *inlen,
+			 char *output, size_t outlen,
+			 charset_state *state, int *error,
+			 struct charset_carry *carry)
 {
-    charset_spec const *spec = charset_find_spec(charset);
     charset_state localstate = CHARSET_INIT_STATE;
     struct charset_emit_param param;
-    int locallen;
+    size_t locallen;
+
+    if (input && !output && outlen == CHARSET_UNBOUNDED && !error) {
+	/*
+	 * A dry run with no limit is just a measurement, unless the
+	 * caller wants to know where the first character is that
+	 * can't be encoded.
+	 */
+	size_t ret = spec_measure_from_unicode(spec, *input, *inlen, state);
+	*input += *inlen;
+	*inlen = 0;
+	return ret;
+    }
 
     if (!input) {
 	locallen = 1;
@@ -45,6 +61,7 @@ int charset_from_unicode(const wchar_t **input, int *inlen,
     param.outlen = outlen;
     param.writtenlen = 0;
     param.stopped = 0;
+    param.carry = carry;
 
     if (state)
 	localstate = *state;	       /* structure copy */
@@ -52,9 +69,62 @@ int charset_from_unicode(const wchar_t **input, int *inlen,
 	*error = FALSE;
 
     while (*inlen > 0) {
-	int lenbefore = param.writtenlen;
+	size_t lenbefore;
 	int ret;
 
+	if (input && param.output && (spec->flags & CSF_ASCII) &&
+	    (unsigned long)**input < 0x80) {
+	    /*
+	     * ASCII is written as itself, so copy as much of it as we
+	     * can straight to the output.
+	     */
+	    size_t n = ascii_narrow(input, *inlen, param.output,
+				    param.outlen);
+
+	    param.output += n;
+	    if (param.outlen != CHARSET_UNBOUNDED)
+		param.outlen -= n;
+	    param.writtenlen += n;
+	    *inlen -= n;
+	    if (*inlen == 0)
+		break;
+	}
+
+	if (input && spec->write_block) {
+	    /*
+	     * Let the block writer handle as much as it can. In a
+	     * dry run we give it a scratch buffer to write into,
+	     * and keep calling it for as long as it's getting
+	     * anywhere.
+	     */
+	    char scratch[256];
+	    size_t blockret;
+
+	    do {
+		if (param.output)
+		    blockret = spec->write_block(spec, input, inlen,
+						 &localstate, param.output,
+						 param.outlen);
+		else
+		    blockret = spec->write_block(spec, input, inlen,
+						 &localstate, scratch,
+						 (param.outlen < sizeof(scratch) ?
+						  param.outlen :
+						  sizeof(scratch)));
+		if (param.output)
+		    param.output += blockret;
+		if (param.outlen != CHARSET_UNBOUNDED)
+		    param.outlen -= blockret;
+		param.writtenlen += blockret;
+	    } while (!param.output && blockret > 0 && *inlen > 0);
+
+	    if (state)
+		*state = localstate;   /* structure copy */
+	    if (*inlen == 0)
+		break;
+	}
+
+	lenbefore = param.writtenlen;
 	if (input)
 	    ret = spec->write(spec, **input, &localstate,
 			      charset_emit, &param);
@@ -66,6 +136,8 @@ int charset_from_unicode(const wchar_t **input, int *inlen,
 	     * wants to know about. Leave now.
 	     */
 	    *error = TRUE;
+	    if (carry)
+		carry->len = 0;
 	    return lenbefore;
 	}
 	if (param.stopped) {
@@ -75,6 +147,8 @@ int charset_from_unicode(const wchar_t **input, int *inlen,
 	     * buffer. Leave immediately, and return what happened
 	     * _before_ attempting to process this character.
 	     */
+	    if (carry)
+		carry->len = 0;
 	    return lenbefore;
 	}
 	if (state)
@@ -82,6 +156,155 @@ int charset_from_unicode(const wchar_t **input, int *inlen,
 	if (input)
 	    (*input)++;
 	(*inlen)--;
+	if (carry && carry->len)
+	    break;		       /* output buffer is full */
     }
     return param.writtenlen;
 }
+
+size_t charset_from_unicode_sz(const wchar_t **input, size_t *inlen,
+			       char *output, size_t outlen,
+			       int charset, charset_state *state, int *error)
+{
+    return spec_from_unicode(charset_find_spec(charset), input, inlen,
+			     output, outlen, state, error, NULL);
+}
+
+int charset_from_unicode(const wchar_t **input, int *inlen,
+			 char *output, int outlen,
+			 int charset, charset_state *state, int *error)
+{
+    size_t len, ret;
+
+    if (!input)
+	return charset_from_unicode_sz(NULL, NULL, output,
+				       (outlen < 0 ? CHARSET_UNBOUNDED :
+					(size_t)outlen), charset, state,
+				       error);
+
+    if (error)
+	*error = FALSE;
+    if (*inlen <= 0)
+	return 0;
+
+    len = *inlen;
+    ret = charset_from_unicode_sz(input, &len, output,
+				  (outlen < 0 ? CHARSET_UNBOUNDED :
+				   (size_t)outlen), charset, state, error);
+    *inlen = len;
+    return ret;
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <string.h>
+
+int total_errs = 0;
+
+/*
+ * Check that a dry run of charset_from_unicode_sz() (no output
+ * buffer and no limit) behaves just like a real one, with and
+ * without `error' and `state': the same length, stopping at the
+ * same place, and leaving the same state behind. Then the same for
+ * charset_from_unicode() with a negative `outlen'.
+ */
+void dryrun_test(int line, int charset, const long *str, int len)
+{
+    wchar_t input[256];
+    char output[1024];
+    int i, usestate, useerror;
+
+    for (i = 0; i < len; i++)
+	input[i] = str[i];
+
+    for (usestate = 0; usestate < 2; usestate++) {
+	for (useerror = 0; useerror < 2; useerror++) {
+	    charset_state st1 = CHARSET_INIT_STATE;
+	    charset_state st2 = CHARSET_INIT_STATE;
+	    const wchar_t *p1 = input, *p2 = input;
+	    size_t left1 = len, left2 = len, ret1, ret2;
+	    int ileft1 = len, ileft2 = len, iret1, iret2;
+	    int err1 = FALSE, err2 = FALSE;
+
+	    ret1 = charset_from_unicode_sz(&p1, &left1, NULL,
+					   CHARSET_UNBOUNDED, charset,
+					   usestate ? &st1 : NULL,
+					   useerror ? &err1 : NULL);
+	    ret2 = charset_from_unicode_sz(&p2, &left2, output,
+					   sizeof(output), charset,
+					   usestate ? &st2 : NULL,
+					   useerror ? &err2 : NULL);
+	    if (ret1 != ret2 || left1 != left2 || p1 - input != p2 - input ||
+		err1 != err2) {
+		printf("%d: (%d,%d) dry run gave %d with %d left, error %d; "
+		       "should be %d with %d left, error %d\n", line,
+		       usestate, useerror, (int)ret1, (int)left1, err1,
+		       (int)ret2, (int)left2, err2);
+		total_errs++;
+	    }
+	    if (memcmp(&st1, &st2, sizeof(st1))) {
+		printf("%d: (%d,%d) dry run final state differs\n",
+		       line, usestate, useerror);
+		total_errs++;
+	    }
+
+	    st1 = st2 = charset_init_state;
+	    p1 = p2 = input;
+	    err1 = err2 = FALSE;
+	    iret1 = charset_from_unicode(&p1, &ileft1, NULL, -1, charset,
+					 usestate ? &st1 : NULL,
+					 useerror ? &err1 : NULL);
+	    iret2 = charset_from_unicode(&p2, &ileft2, output,
+					 sizeof(output), charset,
+					 usestate ? &st2 : NULL,
+					 useerror ? &err2 : NULL);
+	    if (iret1 != iret2 || ileft1 != ileft2 || err1 != err2) {
+		printf("%d: (%d,%d) int dry run gave %d with %d left, "
+		       "error %d; should be %d with %d left, error %d\n",
+		       line, usestate, useerror, iret1, ileft1, err1,
+		       iret2, ileft2, err2);
+		total_errs++;
+	    }
+	}
+    }
+}
+
+/* Macro to concoct the first three parameters of dryrun_test. */
+#define TESTSTR(cs, x) __LINE__, cs, x, lenof(x)
+
+int main(void)
+{
+    printf("dry run tests beginning\n");
+    {
+	const static long str[] = {'a', 'b', 0x4E00, 'c', 'd'};
+	dryrun_test(TESTSTR(CS_ASCII, str));
+	dryrun_test(TESTSTR(CS_ISO8859_1, str));
+	dryrun_test(TESTSTR(CS_UTF8, str));
+    }
+    {
+	const static long str[] = {'c', 'a', 'f', 0xE9, '!'};
+	dryrun_test(TESTSTR(CS_ASCII, str));
+	dryrun_test(TESTSTR(CS_ISO8859_1, str));
+	dryrun_test(TESTSTR(CS_ISO2022_JP, str));
+    }
+    {
+	/* Shifted out when the unencodable character comes along */
+	const static long str[] = {0x65E5, 0x672C, 0xE9, 0x8A9E, 'a'};
+	dryrun_test(TESTSTR(CS_ISO2022_JP, str));
+	dryrun_test(TESTSTR(CS_EUC_JP, str));
+	dryrun_test(TESTSTR(CS_HZ, str));
+	dryrun_test(TESTSTR(CS_UTF7, str));
+    }
+    {
+	const static long str[] = {'a', 0xD800, 'b', 0xFFFF, 'c'};
+	dryrun_test(TESTSTR(CS_UTF8, str));
+	dryrun_test(TESTSTR(CS_UTF16BE, str));
+    }
+    printf("dry run tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
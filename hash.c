@@ -0,0 +1,261 @@
+/*
+ * hash.c - hash and compare text by its decoded characters, without
+ * decoding the whole of it anywhere.
+ */
+
+#include <string.h>
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * A decoder which hands out its output a buffer's worth at a time.
+ */
+struct stream {
+    charset_spec const *spec;
+    const char *input;
+    size_t inlen;
+    charset_state state;
+    wchar_t buf[256];
+    size_t pos, len;
+    int finished;
+};
+
+static void stream_init(struct stream *s, int charset,
+			const char *input, size_t inlen)
+{
+    charset_state init = CHARSET_INIT_STATE;
+
+    s->spec = charset_find_spec(charset);
+    s->input = input;
+    s->inlen = inlen;
+    s->state = init;		       /* structure copy */
+    s->pos = s->len = 0;
+    s->finished = FALSE;
+}
+
+/*
+ * Refill the buffer once it's used up. Returns FALSE when there's
+ * nothing left.
+ */
+static int stream_fill(struct stream *s)
+{
+    if (s->pos < s->len)
+	return TRUE;
+    s->pos = s->len = 0;
+
+    while (s->len == 0 && s->inlen > 0)
+	s->len = spec_to_unicode(s->spec, &s->input, &s->inlen,
+				 s->buf, lenof(s->buf), &s->state,
+				 NULL, 0, NULL, NULL, NULL, NULL, NULL);
+
+    if (s->len == 0 && !s->finished) {
+	/*
+	 * Input which stops part-way through a character ends with
+	 * an invalid sequence, as far as we're concerned.
+	 */
+	s->finished = TRUE;
+	if (s->spec->midchar && s->spec->midchar(s->spec, &s->state))
+	    s->buf[s->len++] = 0xFFFD; /* U+FFFD REPLACEMENT CHARACTER */
+    }
+
+    return s->len > 0;
+}
+
+unsigned long charset_hash(int charset, const char *input, size_t inlen,
+			   unsigned long seed)
+{
+    struct stream s;
+    unsigned long h = (2166136261UL ^ seed) & 0xFFFFFFFFUL;
+    size_t i;
+
+    stream_init(&s, charset, input, inlen);
+    while (stream_fill(&s)) {
+	for (i = s.pos; i < s.len; i++) {
+	    unsigned long c = (unsigned long)s.buf[i];
+	    int j;
+
+	    /*
+	     * FNV-1a over the four bytes of each character, so that the
+	     * answer doesn't depend on the size of wchar_t.
+	     */
+	    for (j = 0; j < 4; j++) {
+		h ^= (c >> (8*j)) & 0xFF;
+		h = (h * 16777619UL) & 0xFFFFFFFFUL;
+	    }
+	}
+	s.pos = s.len;
+    }
+
+    return h;
+}
+
+int charset_equal(int charset_a, const char *a, size_t len_a,
+		  int charset_b, const char *b, size_t len_b)
+{
+    struct stream sa, sb;
+
+    stream_init(&sa, charset_a, a, len_a);
+    stream_init(&sb, charset_b, b, len_b);
+
+    while (1) {
+	int more_a = stream_fill(&sa), more_b = stream_fill(&sb);
+	size_t n;
+
+	if (!more_a || !more_b)
+	    return more_a == more_b;
+
+	n = sa.len - sa.pos;
+	if (n > sb.len - sb.pos)
+	    n = sb.len - sb.pos;
+	if (memcmp(sa.buf + sa.pos, sb.buf + sb.pos, n * sizeof(wchar_t)))
+	    return FALSE;
+	sa.pos += n;
+	sb.pos += n;
+    }
+}
+
+#ifdef TESTMODE
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int total_errs = 0;
+
+/*
+ * Check that `a' and `b' compare as `equal' both ways round, and
+ * that their hashes agree if they're meant to be equal.
+ */
+void equal_test(int line, int charset_a, const char *a, size_t len_a,
+		int charset_b, const char *b, size_t len_b, int equal)
+{
+    unsigned long ha = charset_hash(charset_a, a, len_a, 0);
+    unsigned long hb = charset_hash(charset_b, b, len_b, 0);
+
+    if (charset_equal(charset_a, a, len_a, charset_b, b, len_b) != equal ||
+	charset_equal(charset_b, b, len_b, charset_a, a, len_a) != equal) {
+	printf("%d: charset_equal should have said %s\n", line,
+	       equal ? "TRUE" : "FALSE");
+	total_errs++;
+    }
+    if (equal && ha != hb) {
+	printf("%d: hashes %08lx and %08lx differ\n", line, ha, hb);
+	total_errs++;
+    }
+}
+
+/* Macro to concoct parameters of equal_test from string literals. */
+#define STR(x) x, sizeof(x)-1
+
+int main(void)
+{
+    static const wchar_t sample[] =
+	L"Japanese (\x65E5\x672C\x8A9E)\t\x3053\x3093\x306B\x3061\x306F, "
+	L"\x30B3\x30F3\x30CB\x30C1\x30CF\n";
+    static const int charsets[] = {
+	CS_UTF8, CS_SHIFT_JIS, CS_ISO2022_JP, CS_EUC_JP, CS_UTF16,
+    };
+    wchar_t *text;
+    char *enc[lenof(charsets)], *big1, *big2;
+    size_t enclen[lenof(charsets)], len, i, j;
+    clock_t t0, t1, t2;
+
+    printf("hash tests beginning\n");
+
+    /*
+     * The same long text in several charsets, long enough to go
+     * through the decoding buffers several times at different
+     * rates.
+     */
+    len = 1000;
+    text = malloc(len * sizeof(wchar_t));
+    for (i = 0; i < len; i++)
+	text[i] = sample[i % (lenof(sample) - 1)];
+    for (i = 0; i < lenof(charsets); i++) {
+	const wchar_t *p = text;
+	size_t left = len;
+
+	enc[i] = malloc(len * 8);
+	enclen[i] = charset_from_unicode_sz(&p, &left, enc[i], len * 8,
+					    charsets[i], NULL, NULL);
+	assert(left == 0);
+	enclen[i] += charset_from_unicode_sz(NULL, NULL, enc[i] + enclen[i],
+					     len * 8 - enclen[i], charsets[i],
+					     NULL, NULL);
+    }
+    for (i = 0; i < lenof(charsets); i++) {
+	for (j = 0; j < lenof(charsets); j++) {
+	    equal_test(__LINE__, charsets[i], enc[i], enclen[i],
+		       charsets[j], enc[j], enclen[j], TRUE);
+	    /* One character short, so it differs only at the end */
+	    if (charsets[j] == CS_UTF8)
+		equal_test(__LINE__, charsets[i], enc[i], enclen[i],
+			   charsets[j], enc[j], enclen[j] - 1, FALSE);
+	}
+    }
+    if (charset_hash(CS_UTF8, enc[0], enclen[0], 0) ==
+	charset_hash(CS_UTF8, enc[0], enclen[0], 1)) {
+	printf("%d: seed makes no difference\n", __LINE__);
+	total_errs++;
+    }
+    for (i = 0; i < lenof(charsets); i++)
+	free(enc[i]);
+    free(text);
+
+    /*
+     * Invalid sequences, and ones cut short by the end of the
+     * input, count as U+FFFD.
+     */
+    equal_test(__LINE__, CS_UTF8, STR("abc\xE6\x97"),
+	       CS_UTF8, STR("abc\xEF\xBF\xBD"), TRUE);
+    equal_test(__LINE__, CS_SHIFT_JIS, STR("abc\x93"),
+	       CS_UTF8, STR("abc\xEF\xBF\xBD"), TRUE);
+    equal_test(__LINE__, CS_SHIFT_JIS, STR("abc\x93"),
+	       CS_UTF8, STR("abc"), FALSE);
+    equal_test(__LINE__, CS_UTF8, STR("a\xFF" "b\xE6\x97"),
+	       CS_UTF16, STR("\0a\xFF\xFD\0b\xFF\xFD"), TRUE);
+    equal_test(__LINE__, CS_UTF8, STR(""), CS_ISO2022_JP, STR(""), TRUE);
+    equal_test(__LINE__, CS_UTF8, STR(""), CS_ISO2022_JP, STR("\x1b(B"),
+	       TRUE);
+
+    /*
+     * Text which differs at the start should be dismissed without
+     * decoding the rest, so it ought to take a tiny fraction of the
+     * time a comparison which has to go to the end does.
+     */
+    len = 1 << 23;
+    big1 = malloc(len);
+    big2 = malloc(len);
+    memset(big1, 'a', len);
+    memset(big2, 'a', len);
+    big1[0] = 'x';
+    t0 = clock();
+    if (charset_equal(CS_UTF8, big1, len, CS_UTF8, big2, len)) {
+	printf("%d: charset_equal should have said FALSE\n", __LINE__);
+	total_errs++;
+    }
+    t1 = clock();
+    big1[0] = 'a';
+    big1[len-1] = 'x';
+    if (charset_equal(CS_UTF8, big1, len, CS_UTF8, big2, len)) {
+	printf("%d: charset_equal should have said FALSE\n", __LINE__);
+	total_errs++;
+    }
+    t2 = clock();
+    if ((t1 - t0) * 4 > t2 - t1) {
+	printf("%d: early mismatch took %ld ticks, late one %ld\n",
+	       __LINE__, (long)(t1 - t0), (long)(t2 - t1));
+	total_errs++;
+    }
+    free(big1);
+    free(big2);
+
+    printf("hash tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
@@ -90,6 +90,29 @@ static void read_hz(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * read_hz is part-way through something when it has a character
+ * stored in s1: a tilde, or the first byte of a GB2312 character.
+ */
+static int midchar_hz(charset_spec const *charset,
+		      charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return state->s1 != 0;
+}
+
+/*
+ * In ASCII mode, everything but a tilde stands for itself.
+ */
+static const char *ascii_stops_hz(charset_spec const *charset,
+				  charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return (state->s0 == 0 && state->s1 == 0 ? "~" : NULL);
+}
+
 static int write_hz(charset_spec const *charset, long int input_chr,
 		    charset_state *state,
 		    void (*emit)(void *ctx, long int output), void *emitctx)
@@ -132,7 +155,9 @@ static int write_hz(charset_spec const *charset, long int input_chr,
 }
 
 const charset_spec charset_CS_HZ = {
-    CS_HZ, read_hz, write_hz, NULL
+    CS_HZ, read_hz, write_hz, NULL,
+    NULL, NULL, NULL, NULL, midchar_hz, ascii_stops_hz, NULL,
+    4, 2, 1, CSF_RESET
 };
 
 #else /* ENUM_CHARSETS */
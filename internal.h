@@ -48,8 +48,131 @@ struct charset_spec {
 		 charset_state *state,
 		 void (*emit)(void *ctx, long int output), void *emitctx);
     void const *data;
+
+    /*
+     * Optional block versions of `read' and `write', either or
+     * both of which may be NULL. They exist purely for speed: each
+     * one takes a whole span of input and a whole span of output,
+     * and converts as much as it conveniently can without going
+     * through an `emit' function at all.
+     * 
+     * Both functions advance `*input' and decrement `*inlen' past
+     * the input they consumed, update `state' exactly as the
+     * equivalent sequence of calls to `read' or `write' would
+     * have done, and return the number of output units written.
+     * `output' is never NULL.
+     * 
+     * Either function may stop early for any reason it likes, and
+     * the caller will then fall back to `read' or `write' for the
+     * next unit of input. In particular, they _must_ stop before
+     * any input unit which would cause `read' to emit ERROR or
+     * `write' to return FALSE, or which would produce more output
+     * than there is room for; that way, all the error handling
+     * and partial-output logic stays in one place. `write_block'
+     * is never asked to reset the encoding state.
+     */
+    size_t (*read_block)(charset_spec const *charset,
+			 const char **input, size_t *inlen,
+			 charset_state *state, wchar_t *output, size_t outlen);
+    size_t (*write_block)(charset_spec const *charset,
+			  const wchar_t **input, size_t *inlen,
+			  charset_state *state, char *output, size_t outlen);
+
+    /*
+     * Optional counting functions, used when measuring how much
+     * output a conversion would produce without doing it. Each one
+     * advances `*input' and decrements `*inlen' in the same way as
+     * the block functions above, updates `state' in the same way,
+     * and returns the number of output units `read' or `write'
+     * would have produced for the input it consumed. `read_count'
+     * must count each ERROR as `errlen' units.
+     * 
+     * The point of these is to be fast, so they should avoid
+     * looking at mapping tables wherever the answer doesn't depend
+     * on them. Like the block functions, they may stop whenever
+     * they like, and the caller will count the next unit by
+     * calling `read' or `write'.
+     */
+    size_t (*read_count)(charset_spec const *charset,
+			 const char **input, size_t *inlen,
+			 charset_state *state, size_t errlen);
+    size_t (*write_count)(charset_spec const *charset,
+			  const wchar_t **input, size_t *inlen,
+			  charset_state *state);
+
+    /*
+     * Optional function which reports whether a reading state is
+     * holding on to part of a character (or escape sequence) whose
+     * bytes have been consumed but which has not yet produced any
+     * output. This is used to work out which input bytes each
+     * output character came from. NULL means the answer is always
+     * FALSE, as it is for an SBCS.
+     */
+    int (*midchar)(charset_spec const *charset, charset_state const *state);
+
+    /*
+     * Optional function which reports whether, in a given reading
+     * state, ASCII bytes simply stand for themselves: that is,
+     * `read' would emit each one unchanged and leave the state as
+     * it was. If so, it returns a string of the ASCII bytes which
+     * are exceptions to that (escape or shift characters, say),
+     * and the caller may then copy any run of other ASCII bytes
+     * straight to the output. If not, it returns NULL.
+     * 
+     * Charsets with CSF_ASCII needn't provide this: for them, the
+     * caller assumes the answer is "" whenever `midchar' returns
+     * FALSE.
+     */
+    const char *(*ascii_stops)(charset_spec const *charset,
+			       charset_state const *state);
+
+    /*
+     * Optional function to find a place where decoding can be
+     * picked up part-way through some input, for converting it in
+     * pieces in parallel. `input' and `inlen' describe the whole
+     * input, and `*state' is the reading state at its start. The
+     * function looks for a position, at or after `pos', at which
+     * it can tell what the state would be after decoding everything
+     * before it, without actually doing so; it sets `*state' to
+     * that, and returns the position. If there's no such position
+     * before the end of the input, it returns `inlen'.
+     * 
+     * NULL means the charset can't be picked up part-way, so that
+     * the whole input must be decoded in one go.
+     */
+    size_t (*sync)(charset_spec const *charset,
+		   const unsigned char *input, size_t inlen, size_t pos,
+		   charset_state *state);
+
+    /*
+     * Static facts about the charset, reported to clients by
+     * charset_info().
+     * 
+     * `maxbytes' is the most bytes `write' can ever emit for a
+     * single input character, counting any shift or escape
+     * sequences it has to output first. `maxreset' is the most it
+     * can emit when asked to reset the encoding state. `maxchars'
+     * is the most Unicode characters (counting each ERROR as one)
+     * that `read' can emit for a single input byte.
+     * 
+     * `flags' is a combination of the CSF_* values below.
+     */
+    int maxbytes, maxreset, maxchars;
+    int flags;
 };
 
+/*
+ * Values for the `flags' field in charset_spec.
+ */
+#define CSF_STATELESS 1		       /* state is always initial between
+					* characters, reading or writing */
+#define CSF_SELFSYNC 2		       /* character boundaries can be found
+					* by looking at nearby bytes */
+#define CSF_ASCII 4		       /* bytes 00-7F mean exactly ASCII,
+					* in both directions */
+#define CSF_RESET 8		       /* output may need terminating by a
+					* reset sequence */
+
 /*
  * This is the format of `data' used by the SBCS read and write
  * functions; so it's the format used in all SBCS definitions.
@@ -79,18 +202,208 @@ struct sbcs_data {
      */
     unsigned char ucs2sbcs[256];
     int nvalid;
+
+    /*
+     * A bitmap of the byte values which are defined in the SBCS
+     * (i.e. whose sbcs2ucs entry is not ERROR), 32 to a word with
+     * byte value 0 in the bottom bit of the first word. Each word
+     * holds exactly 32 bits: an unsigned long may be longer, but
+     * anything above bit 31 is always zero. This lets us check
+     * input for validity without looking at sbcs2ucs.
+     */
+    unsigned long valid[8];
+
+    /*
+     * The UTF-8 encoding of each byte's Unicode value, padded with
+     * zeroes, so that we can decode straight to UTF-8 by copying.
+     * The length can be told from the first byte as usual; an
+     * undefined byte value has 0xFF there instead.
+     */
+    unsigned char sbcs2utf8[256][4];
+};
+
+/*
+ * Data for one of the simple double-byte encodings handled in
+ * dbcs.c: a bitmap of its lead bytes, laid out as in `valid' above.
+ */
+struct dbcs_data {
+    unsigned long lead[8];
 };
+#define DBCS_LEAD(dd, c) ((dd)->lead[(c) >> 5] & (1UL << ((c) & 31)))
 
 /*
  * Prototypes for internal library functions.
  */
+/*
+ * Somewhere for the conversion functions to put output which
+ * doesn't fit in the caller's buffer, so that the work which
+ * produced it needn't be thrown away and redone on the next call.
+ * The conversion functions only ever add to an empty carry buffer,
+ * and stop as soon as they've done so; it's up to the caller to
+ * hand the contents on (starting at `pos') before calling them
+ * again. If even the carry buffer isn't big enough, they stop
+ * before the input unit in question as they would without one.
+ */
+#define CARRYLEN 256
+
+struct unicode_carry {
+    wchar_t buf[CARRYLEN];
+    size_t pos, len;
+};
+
+struct charset_carry {
+    char buf[CARRYLEN];
+    size_t pos, len;
+};
+
+/*
+ * A decoder fed one byte at a time, which passes each character it
+ * decodes to `output' along with the offset of the input sequence
+ * it came from (worked out by output_source()). Errors are passed
+ * on as ERROR. source_feed_byte(), in sink.c, feeds it the byte at
+ * offset `pos'; anyone skipping bytes without feeding them must set
+ * `start' to the offset after them.
+ */
+struct source_feed {
+    charset_spec const *spec;
+    charset_state state;
+    size_t start;		       /* where the current character began */
+    size_t pos;			       /* offset of the byte being read */
+    long int pending;		       /* last output for this byte */
+    int nemitted;		       /* calls to emit for this byte */
+    void (*output)(void *ctx, long int c, size_t offset);
+    void *outctx;
+};
+
+/*
+ * spec_to_units() decodes straight into some Unicode encoding other
+ * than wchar_t, such as UTF-8 or UTF-16 code units; a units_writer
+ * says how. `emit' is an emit function for `read', with a
+ * units_param as its context, which encodes each character (or
+ * ERROR, using `errstr' if non-NULL) and writes it with
+ * units_put(). `ascii' writes `n' ASCII bytes standing for
+ * themselves, there being room for them. `block', if non-NULL,
+ * decodes a run of input some quicker way if it can (advancing
+ * `*input' and `*inlen' over what it used); it may stop part-way
+ * through when the output fills up, setting `stopped'.
+ */
+struct units_param {
+    void *output;
+    size_t outlen;		       /* both counted in units */
+    size_t writtenlen;
+    const void *errstr;
+    size_t errlen;
+    int stopped;
+    struct units_writer const *writer;
+};
+
+struct units_writer {
+    size_t unitsize;
+    void (*emit)(void *ctx, long int output);
+    void (*ascii)(struct units_param *param, const unsigned char *p,
+		  size_t n);
+    void (*block)(charset_spec const *spec,
+		  const char **input, size_t *inlen,
+		  charset_state *state, struct units_param *param);
+};
+
 charset_spec const *charset_find_spec(int charset);
+size_t spec_to_unicode(charset_spec const *spec,
+		       const char **input, size_t *inlen,
+		       wchar_t *output, size_t outlen,
+		       charset_state *state,
+		       const wchar_t *errstr, size_t errlen,
+		       void (*errfn)(void *ctx, size_t offset, size_t length),
+		       void *errctx,
+		       int (*eolfn)(void *ctx, wchar_t c, size_t outpos,
+				    size_t offset, size_t inend,
+				    charset_state const *state),
+		       void *eolctx, struct unicode_carry *carry);
+size_t spec_to_units(charset_spec const *spec,
+		     const char **input, size_t *inlen,
+		     void *output, size_t outlen, charset_state *state,
+		     const void *errstr, size_t errlen,
+		     struct units_writer const *writer);
+void units_put(struct units_param *param, const void *p, size_t len);
+const char *current_ascii_stops(charset_spec const *spec,
+				charset_state const *state);
+void output_source(size_t start, size_t pos, int partial, int i, int k,
+		   size_t *offset, size_t *length);
+void source_feed_byte(struct source_feed *f, unsigned char c, size_t pos);
+void null_emit(void *ctx, long int output);
+size_t spec_from_unicode(charset_spec const *spec,
+			 const wchar_t **input, size_t *inlen,
+			 char *output, size_t outlen,
+			 charset_state *state, int *error,
+			 struct charset_carry *carry);
+size_t spec_measure_to_unicode(charset_spec const *spec,
+			       const char *input, size_t inlen,
+			       charset_state *state,
+			       const wchar_t *errstr, size_t errlen);
+size_t spec_measure_from_unicode(charset_spec const *spec,
+				 const wchar_t *input, size_t inlen,
+				 charset_state *state);
+size_t spec_convert(charset_spec const *src, charset_spec const *dst,
+		    const char **input, size_t *inlen,
+		    char *output, size_t outlen,
+		    charset_state *srcstate, charset_state *dststate,
+		    int *error, struct charset_carry *carry);
 void read_sbcs(charset_spec const *charset, long int input_chr,
 	       charset_state *state,
 	       void (*emit)(void *ctx, long int output), void *emitctx);
 int write_sbcs(charset_spec const *charset, long int input_chr,
 	       charset_state *state,
 	       void (*emit)(void *ctx, long int output), void *emitctx);
+size_t read_sbcs_block(charset_spec const *charset,
+		       const char **input, size_t *inlen,
+		       charset_state *state, wchar_t *output, size_t outlen);
+size_t write_sbcs_block(charset_spec const *charset,
+			const wchar_t **input, size_t *inlen,
+			charset_state *state, char *output, size_t outlen);
+size_t read_sbcs_count(charset_spec const *charset,
+		       const char **input, size_t *inlen,
+		       charset_state *state, size_t errlen);
+size_t write_sbcs_count(charset_spec const *charset,
+			const wchar_t **input, size_t *inlen,
+			charset_state *state);
+size_t sync_sbcs(charset_spec const *charset,
+		 const unsigned char *input, size_t inlen, size_t pos,
+		 charset_state *state);
+size_t read_dbcs_count(charset_spec const *charset,
+		       const char **input, size_t *inlen,
+		       charset_state *state, size_t errlen);
+int midchar_dbcs(charset_spec const *charset, charset_state const *state);
+size_t sync_dbcs(charset_spec const *charset,
+		 const unsigned char *input, size_t inlen, size_t pos,
+		 charset_state *state);
+
+/*
+ * One set of the scanning functions in scan.c, for a particular
+ * kind of CPU. scanavx2.c and scanavx512.c each supply one, or
+ * NULL if they weren't compiled with the flags to allow it.
+ */
+struct scan_kernels {
+    const char *name;
+    size_t (*ascii_span)(const unsigned char *p, size_t len);
+    size_t (*utf16_plain_span)(const unsigned char *p, size_t len,
+			       int bigendian);
+    size_t (*ascii_widen)(const unsigned char **input, size_t inlen,
+			  wchar_t *output, size_t outlen);
+    size_t (*ascii_narrow)(const wchar_t **input, size_t inlen,
+			   char *output, size_t outlen);
+};
+extern const struct scan_kernels *const scan_kernels_avx2;
+extern const struct scan_kernels *const scan_kernels_avx512;
+
+size_t ascii_span(const unsigned char *p, size_t len);
+size_t utf16_plain_span(const unsigned char *p, size_t len, int bigendian);
+size_t validate_utf8(const unsigned char *p, size_t len);
+size_t ascii_span_except(const unsigned char *p, size_t len,
+			 const char *stops);
+size_t ascii_widen(const unsigned char **input, size_t inlen,
+		   wchar_t *output, size_t outlen);
+size_t ascii_narrow(const wchar_t **input, size_t inlen,
+		    char *output, size_t outlen);
 long int sbcs_to_unicode(const struct sbcs_data *sd, long int input_chr);
 long int sbcs_from_unicode(const struct sbcs_data *sd, long int input_chr);
 
@@ -101,6 +414,15 @@ int write_utf8(charset_spec const *charset, long int input_chr,
 	       charset_state *state,
 	       void (*emit)(void *ctx, long int output),
 	       void *emitctx);
+void read_utf16(charset_spec const *charset, long int input_chr,
+		charset_state *state,
+		void (*emit)(void *ctx, long int output), void *emitctx);
+size_t read_utf16_units(charset_spec const *charset,
+			const char **input, size_t *inlen,
+			charset_state *state, charset_char16 *output,
+			size_t outlen);
+int utf16_input_bigendian(charset_spec const *charset,
+			  const unsigned char *input, size_t inlen);
 
 long int big5_to_unicode(int r, int c);
 int unicode_to_big5(long int unicode, int *r, int *c);
@@ -236,6 +236,7 @@ static long int emacs_big5_2_to_unicode(int r, int c)
     s = r * 94 + c;
     r = s / 157 + 40;
     c = s % 157;
+    if (r >= 94) return ERROR; /* Off the end of Big5 */
     if (c >= 64) c += 34; /* Skip over the gap */
     return big5_to_unicode(r, c);
 }
@@ -806,6 +807,85 @@ static void read_iso2022(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * read_iso2022 is part-way through something if it's in the middle
+ * of an escape sequence or a single-shifted character, or has the
+ * first byte of a double-byte character stored. Inside a DOCS
+ * segment it depends on what the segment's own decoder is up to.
+ */
+static int midchar_iso2022(charset_spec const *charset,
+			   charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    switch (MODE) {
+      case IDLE:
+	return (state->s0 & 0x00ff0000L) != 0;
+      case ESCPASS:
+	return FALSE;
+      case DOCSUTF8:
+	/* a partial UTF-8 character, or a partial ESC % @ */
+	return (state->s0 & 0x0fffffffL) != 0;
+      case DOCSCTEXT:
+	/*
+	 * We're part-way through the segment header until we've
+	 * got the length and the whole encoding name; after that,
+	 * only if the sub-charset has a lead byte stored.
+	 */
+	return (((state->s0 >> 8) & 0x3fff) == 0 ||
+		((state->s0 >> 22) & 0xf) != 0xf ||
+		(state->s0 & 0xff) != 0);
+      default:
+	return TRUE;
+    }
+}
+
+/*
+ * read_iso2022 goes back to its idle state, with nothing
+ * accumulated, after any control character other than the ones
+ * which start escape sequences or shift; except inside a DOCS
+ * segment. The designations and shifts in effect there depend only
+ * on the escape sequences, shifts and DOCS segments before it, so
+ * we find those out by running read_iso2022 over just those, and
+ * skip everything in between.
+ */
+static size_t sync_iso2022(charset_spec const *charset,
+			   const unsigned char *input, size_t inlen,
+			   size_t pos, charset_state *state)
+{
+    charset_state st = *state;	       /* structure copy */
+    size_t i;
+
+    for (i = 0; i < inlen; i++) {
+	unsigned c = input[i];
+	int control = ((c & 0x60) == 0x00);
+
+	if (i == 0 || (st.s0 >> 29) != IDLE ||
+	    (control && (c == ESC || c == LS0 || c == LS1 ||
+			 c == SS2 || c == SS3))) {
+	    read_iso2022(charset, c, &st, null_emit, NULL);
+	    continue;
+	}
+	if (i + 1 < pos) {
+	    /*
+	     * Nothing here matters until we get to an ESC or a
+	     * shift.
+	     */
+	    size_t n = ascii_span_except(input + i, pos - 1 - i,
+					 "\016\017\033");
+	    if (n > 0)
+		i += n - 1;
+	    continue;
+	}
+	if (control) {
+	    state->s0 = 0;
+	    state->s1 = st.s1;
+	    return i + 1;
+	}
+    }
+    return inlen;
+}
+
 static void oselect(charset_state *state, int i, int right,
 		    void (*emit)(void *ctx, long int output),
 		    void *emitctx)
@@ -1168,7 +1248,7 @@ static int write_iso2022(charset_spec const *charset, long int input_chr,
 
 	for (i = 0; (unsigned)i <= lenof(ctext_encodings); i++) {
 	    charset_state substate;
-	    charset_spec const *subcs = ctext_encodings[i].subcs;
+	    charset_spec const *subcs;
 
 	    /*
 	     * We assume that all character sets dealt with by DOCS
@@ -1178,6 +1258,7 @@ static int write_iso2022(charset_spec const *charset, long int input_chr,
 	    p = data;
 
 	    if ((unsigned)i < lenof(ctext_encodings)) {
+		subcs = ctext_encodings[i].subcs;
 		if ((mode->enable_mask & (1 << ctext_encodings[i].enable)) &&
 		    subcs->write(subcs, input_chr, &substate,
 				 write_to_pointer, &p)) {
@@ -1213,8 +1294,22 @@ static const struct iso2022_mode iso2022_all = {
     S4, 0, 'B', S4, 0, 'B',
 };
 
+/*
+ * Size bounds. No subcharset needs an intermediate byte, so the
+ * longest designation is ESC $ ) F (4 bytes), and a character is
+ * at most 2 bytes. Length-encoded DOCS is never used here, since
+ * the Emacs Big5 and ISO 8859-14/15 subcharsets cover everything it
+ * could carry, so the worst character is either ESC % @ (leaving
+ * DOCS UTF-8), a designation and a DBCS character, 3+4+2 = 9, or
+ * ESC % G and up to 6 bytes of UTF-8, 3+6 = 9. A reset is ESC % @
+ * plus re-designating G0 and G1, 3+3+3 = 9. When reading, the most
+ * a byte can produce is an unrecognised escape passed through
+ * whole: ESC, two intermediates and the final, 4 characters.
+ */
 const charset_spec charset_CS_ISO2022 = {
-    CS_ISO2022, read_iso2022, write_iso2022, &iso2022_all
+    CS_ISO2022, read_iso2022, write_iso2022, &iso2022_all,
+    NULL, NULL, NULL, NULL, midchar_iso2022, NULL, sync_iso2022,
+    9, 9, 4, CSF_RESET
 };
 
 /*
@@ -1226,8 +1321,18 @@ static const struct iso2022_mode iso2022_ctext = {
     S4, 0, 'B', S6, 0, 'A',
 };
 
+/*
+ * Size bounds. Here the worst case is leaving a full length-encoded
+ * DOCS segment, ESC % / F M L (6 bytes), the longest name
+ * "iso8859-14\2" (11) and 5 stored bytes, 22 in all, before a
+ * designation and a DBCS character, 22+4+2 = 28. A reset is the
+ * same 22 plus ESC ( B and ESC - A, 28 again. Reading is as for
+ * CS_ISO2022.
+ */
 const charset_spec charset_CS_CTEXT = {
-    CS_CTEXT, read_iso2022, write_iso2022, &iso2022_ctext
+    CS_CTEXT, read_iso2022, write_iso2022, &iso2022_ctext,
+    NULL, NULL, NULL, NULL, midchar_iso2022, NULL, sync_iso2022,
+    28, 28, 4, CSF_RESET
 };
 
 #ifdef TESTMODE
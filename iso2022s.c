@@ -326,6 +326,80 @@ static void read_iso2022s(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * read_iso2022s is part-way through something if it is in an
+ * escape sequence, or has accumulated some bytes of a character.
+ */
+static int midchar_iso2022s(charset_spec const *charset,
+			    charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return (state->s0 & 0xFF000000) != 0 || (state->s1 & 0x0F000000) != 0;
+}
+
+/*
+ * ASCII stands for itself (apart from the shift and escape
+ * characters) once we've initialised, when we're in the SI
+ * container, not part-way through anything, and sub-charset 0 is
+ * selected there. (Sub-charset 0 is ASCII in all the subsets we
+ * support.)
+ */
+static const char *ascii_stops_iso2022s(charset_spec const *charset,
+					charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    if (state->s0 == 0 && (state->s1 & 0xFF00003F) == 0x80000000)
+	return "\016\017\033";	       /* SO, SI, ESC */
+    return NULL;
+}
+
+/*
+ * read_iso2022s is at a character boundary, outside any escape
+ * sequence, after any control character other than the ones which
+ * can introduce an escape sequence. Its designations and shift
+ * state there depend only on the escape sequences and shifts before
+ * it; so we find out what those are by running read_iso2022s over
+ * just those, skipping everything in between. (If we're in a
+ * single-shifted container, which the subsets we support never
+ * use, we have to look at everything until we come out.)
+ */
+static size_t sync_iso2022s(charset_spec const *charset,
+			    const unsigned char *input, size_t inlen,
+			    size_t pos, charset_state *state)
+{
+    struct iso2022 const *iso = (struct iso2022 *)charset->data;
+    charset_state st = *state;	       /* structure copy */
+    size_t i;
+
+    for (i = 0; i < inlen; i++) {
+	unsigned c = input[i];
+
+	if (i == 0 || (st.s0 >> 24) || (st.s1 & 0x60000000) ||
+	    c == SO || c == SI || c == ESC) {
+	    read_iso2022s(charset, c, &st, null_emit, NULL);
+	    continue;
+	}
+	if (i + 1 < pos) {
+	    /*
+	     * Nothing here matters until we get to an introducer.
+	     */
+	    size_t n = ascii_span_except(input + i, pos - 1 - i,
+					 "\016\017\033");
+	    if (n > 0)
+		i += n - 1;
+	    continue;
+	}
+	if (c < 0x21 || (c > 0x7E && (!iso->eightbit || c < 0xA0))) {
+	    state->s0 = 0;
+	    state->s1 = st.s1 & ~0x0F000000;
+	    return i + 1;
+	}
+    }
+    return inlen;
+}
+
 static int write_iso2022s(charset_spec const *charset, long int input_chr,
 			  charset_state *state,
 			  void (*emit)(void *ctx, long int output),
@@ -491,7 +565,10 @@ static const struct iso2022 iso2022jp = {
     iso2022jp_to_ucs, iso2022jp_from_ucs
 };
 const charset_spec charset_CS_ISO2022_JP = {
-    CS_ISO2022_JP, read_iso2022s, write_iso2022s, &iso2022jp
+    CS_ISO2022_JP, read_iso2022s, write_iso2022s, &iso2022jp,
+    NULL, NULL, NULL, NULL, midchar_iso2022s,
+    ascii_stops_iso2022s, sync_iso2022s,
+    5, 3, 3, CSF_RESET
 };
 
 /*
@@ -533,7 +610,10 @@ static const struct iso2022 iso2022kr = {
     iso2022kr_to_ucs, iso2022kr_from_ucs
 };
 const charset_spec charset_CS_ISO2022_KR = {
-    CS_ISO2022_KR, read_iso2022s, write_iso2022s, &iso2022kr
+    CS_ISO2022_KR, read_iso2022s, write_iso2022s, &iso2022kr,
+    NULL, NULL, NULL, NULL, midchar_iso2022s,
+    ascii_stops_iso2022s, sync_iso2022s,
+    7, 4, 4, CSF_RESET
 };
 
 #else /* ENUM_CHARSETS */
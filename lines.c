@@ -0,0 +1,323 @@
+/*
+ * lines.c - decode to Unicode, reporting where each line ends.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+struct line_param {
+    int (*linefn)(void *ctx, const charset_line *line);
+    void *linectx;
+    /*
+     * Where the last CR went, if it was the last thing decoded, so
+     * that an LF straight after it can take it into its line ending.
+     */
+    int havecr;
+    size_t crout, crin;
+};
+
+static int line_eol(void *ctx, wchar_t c, size_t outpos, size_t offset,
+		    size_t inend, charset_state const *state)
+{
+    struct line_param *param = (struct line_param *)ctx;
+    charset_line line;
+
+    if (c == '\r') {
+	param->havecr = TRUE;
+	param->crout = outpos;
+	param->crin = offset;
+	return FALSE;
+    }
+
+    if (param->havecr && param->crout + 1 == outpos) {
+	line.outpos = param->crout;
+	line.inpos = param->crin;
+    } else {
+	line.outpos = outpos;
+	line.inpos = offset;
+    }
+    line.outend = outpos + 1;
+    line.inend = inend;
+    line.state = *state;	       /* structure copy */
+    param->havecr = FALSE;
+    return param->linefn && param->linefn(param->linectx, &line);
+}
+
+size_t charset_to_unicode_lines(const char **input, size_t *inlen,
+				wchar_t *output, size_t outlen,
+				int charset, charset_state *state,
+				const wchar_t *errstr, size_t errlen,
+				int (*linefn)(void *ctx,
+					      const charset_line *line),
+				void *linectx)
+{
+    struct line_param param;
+
+    param.linefn = linefn;
+    param.linectx = linectx;
+    param.havecr = FALSE;
+
+    return spec_to_unicode(charset_find_spec(charset), input, inlen,
+			   output, outlen, state, errstr, errlen,
+			   NULL, NULL, line_eol, &param, NULL);
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <string.h>
+
+int total_errs = 0;
+
+struct line_log {
+    int n, stopat;
+    charset_line lines[8];
+};
+
+static int log_line(void *ctx, const charset_line *line)
+{
+    struct line_log *log = (struct line_log *)ctx;
+
+    if (log->n < (int)lenof(log->lines))
+	log->lines[log->n] = *line;    /* structure copy */
+    log->n++;
+    return log->n == log->stopat;
+}
+
+/*
+ * Decode `input' in one call, stopping after line `stopat' (or
+ * never, if 0), and check the line endings reported against `exp',
+ * which holds outpos, outend, inpos and inend for each, and the
+ * number of input bytes used. Also check that the output matches
+ * charset_to_unicode_sz(), and that decoding the rest of the input
+ * from each reported state matches the rest of the output.
+ */
+void lines_test(int line, int charset, const char *input, size_t inlen,
+		int stopat, const size_t *exp, int nexp, size_t expused)
+{
+    wchar_t output[256], expected[256];
+    struct line_log log;
+    const char *in = input;
+    size_t left = inlen, ret, expret;
+    int i;
+
+    log.n = 0;
+    log.stopat = stopat;
+    ret = charset_to_unicode_lines(&in, &left, output, lenof(output),
+				   charset, NULL, NULL, 0, log_line, &log);
+    if (in - input != (int)expused || left != inlen - expused) {
+	printf("%d: used %d bytes, expected %d\n",
+	       line, (int)(in - input), (int)expused);
+	total_errs++;
+	return;
+    }
+    if (log.n != nexp) {
+	printf("%d: %d line endings, expected %d\n", line, log.n, nexp);
+	total_errs++;
+	return;
+    }
+    for (i = 0; i < nexp; i++) {
+	const charset_line *l = &log.lines[i];
+
+	if (l->outpos != exp[4*i] || l->outend != exp[4*i+1] ||
+	    l->inpos != exp[4*i+2] || l->inend != exp[4*i+3]) {
+	    printf("%d: line %d ends at out %d-%d in %d-%d, expected "
+		   "out %d-%d in %d-%d\n", line, i,
+		   (int)l->outpos, (int)l->outend,
+		   (int)l->inpos, (int)l->inend,
+		   (int)exp[4*i], (int)exp[4*i+1],
+		   (int)exp[4*i+2], (int)exp[4*i+3]);
+	    total_errs++;
+	}
+    }
+
+    in = input;
+    left = expused;
+    expret = charset_to_unicode_sz(&in, &left, expected, lenof(expected),
+				   charset, NULL, NULL, 0);
+    if (ret != expret || memcmp(output, expected, ret * sizeof(wchar_t))) {
+	printf("%d: output differs from charset_to_unicode_sz\n", line);
+	total_errs++;
+	return;
+    }
+
+    for (i = 0; i < nexp; i++) {
+	const charset_line *l = &log.lines[i];
+	charset_state state = l->state;	/* structure copy */
+
+	in = input + l->inend;
+	left = expused - l->inend;
+	expret = charset_to_unicode_sz(&in, &left, expected, lenof(expected),
+				       charset, &state, NULL, 0);
+	if (expret != ret - l->outend ||
+	    memcmp(expected, output + l->outend, expret * sizeof(wchar_t))) {
+	    printf("%d: decoding on from line %d's state differs\n",
+		   line, i);
+	    total_errs++;
+	}
+    }
+}
+
+#define LINES(charset, input, stopat, used, exp) \
+    lines_test(__LINE__, charset, input, sizeof(input)-1, stopat, \
+	       exp, lenof(exp) / 4, used)
+
+/*
+ * Decode `first' and then `second' in two calls, carrying the state
+ * across, and check the single LF in `second' is reported at `exp'.
+ */
+void split_test(int line, int charset, const char *first, size_t firstlen,
+		const char *second, size_t secondlen, const size_t *exp)
+{
+    wchar_t output[64];
+    charset_state state = CHARSET_INIT_STATE;
+    struct line_log log;
+    const char *in;
+    size_t left;
+
+    log.n = 0;
+    log.stopat = 0;
+    in = first;
+    left = firstlen;
+    charset_to_unicode_lines(&in, &left, output, lenof(output), charset,
+			     &state, NULL, 0, log_line, &log);
+    if (log.n != 0) {
+	printf("%d: %d line endings in first call, expected none\n",
+	       line, log.n);
+	total_errs++;
+	return;
+    }
+    in = second;
+    left = secondlen;
+    charset_to_unicode_lines(&in, &left, output, lenof(output), charset,
+			     &state, NULL, 0, log_line, &log);
+    if (log.n != 1) {
+	printf("%d: %d line endings in second call, expected one\n",
+	       line, log.n);
+	total_errs++;
+	return;
+    }
+    if (log.lines[0].outpos != exp[0] || log.lines[0].outend != exp[1] ||
+	log.lines[0].inpos != exp[2] || log.lines[0].inend != exp[3] ||
+	output[log.lines[0].outpos + exp[1] - exp[0] - 1] != '\n') {
+	printf("%d: line ends at out %d-%d in %d-%d, expected "
+	       "out %d-%d in %d-%d\n", line,
+	       (int)log.lines[0].outpos, (int)log.lines[0].outend,
+	       (int)log.lines[0].inpos, (int)log.lines[0].inend,
+	       (int)exp[0], (int)exp[1], (int)exp[2], (int)exp[3]);
+	total_errs++;
+    }
+}
+
+#define SPLIT(charset, first, second, exp) \
+    split_test(__LINE__, charset, first, sizeof(first)-1, \
+	       second, sizeof(second)-1, exp)
+
+int main(void)
+{
+    /*
+     * Plain ASCII-based charsets, with and without CRs.
+     */
+    {
+	static const size_t exp[] = { 2, 4, 2, 4,  6, 7, 6, 7 };
+	LINES(CS_ASCII, "ab\r\ncd\nef", 0, 9, exp);
+	LINES(CS_UTF8, "ab\r\ncd\nef", 0, 9, exp);
+	LINES(CS_ISO8859_1, "ab\r\ncd\nef", 0, 9, exp);
+    }
+    {
+	/* a lone CR isn't a line ending, but doesn't stop the next */
+	static const size_t exp[] = { 3, 5, 3, 5 };
+	LINES(CS_UTF8, "a\rb\r\n", 0, 5, exp);
+    }
+    {
+	/* a CR which isn't straight before the LF isn't counted */
+	static const size_t exp[] = { 3, 4, 3, 4 };
+	LINES(CS_UTF8, "a\rb\n", 0, 4, exp);
+    }
+    {
+	/* multibyte characters before each line ending */
+	static const size_t exp[] = { 1, 3, 2, 4,  4, 5, 7, 8 };
+	LINES(CS_UTF8, "\xC3\xA9\r\n\xE2\x82\xAC\n", 0, 8, exp);
+    }
+    {
+	/* UTF-16, where CR and LF take two bytes each */
+	static const size_t exp[] = { 1, 3, 2, 6 };
+	LINES(CS_UTF16BE, "\0a\0\r\0\n\0b", 0, 8, exp);
+    }
+
+    /*
+     * linefn returning TRUE stops just after that line ending.
+     */
+    {
+	static const size_t exp[] = { 1, 2, 1, 2 };
+	LINES(CS_UTF8, "a\nb\nc", 1, 2, exp);
+    }
+    {
+	static const size_t exp[] = { 1, 2, 1, 2,  3, 5, 3, 5 };
+	LINES(CS_UTF8, "a\nb\r\nc\n", 2, 5, exp);
+    }
+    {
+	static const size_t exp[] = { 2, 4, 4, 8 };
+	LINES(CS_UTF16BE, "\0a\0b\0\r\0\n\0c", 1, 8, exp);
+    }
+
+    /*
+     * A CRLF split across two calls, both between the CR and the LF
+     * and part-way through the LF itself. The CR from the first call
+     * isn't counted; the LF's input span starts at the start of the
+     * second call even if some of it was in the first.
+     */
+    {
+	static const size_t exp[] = { 0, 1, 0, 1 };
+	SPLIT(CS_UTF8, "ab\r", "\ncd", exp);
+	SPLIT(CS_ISO8859_1, "ab\r", "\ncd", exp);
+    }
+    {
+	static const size_t exp[] = { 0, 1, 0, 2 };
+	SPLIT(CS_UTF16BE, "\0a\0\r", "\0\nx", exp);
+    }
+    {
+	static const size_t exp[] = { 0, 1, 0, 1 };
+	SPLIT(CS_UTF16BE, "\0a\0\r\0", "\n", exp);
+    }
+
+    /*
+     * Stateful charsets, where the state at each line ending is
+     * worth having; lines_test checks that decoding can carry on
+     * from it.
+     */
+    {
+	/* kanji mode carries on across the LF */
+	static const size_t exp[] = { 1, 2, 5, 6,  4, 5, 12, 13 };
+	LINES(CS_ISO2022_JP, "\x1B$B0!\n0\"\x1B(Bx\ny", 0, 14, exp);
+    }
+    {
+	static const size_t exp[] = { 1, 3, 5, 7 };
+	LINES(CS_ISO2022_JP, "\x1B$B0!\r\n0\"\x1B(B", 0, 12, exp);
+    }
+    {
+	/* "~\n" is a line continuation in HZ, and produces nothing */
+	static const size_t exp[] = { 2, 3, 4, 5,  3, 4, 5, 6,  5, 6, 12, 13 };
+	LINES(CS_HZ, "a~\nb\n\n~{0!~}\n", 0, 13, exp);
+    }
+    {
+	/* GB2312 mode has to end before the line does */
+	static const size_t exp[] = { 1, 2, 6, 7,  4, 5, 14, 15 };
+	LINES(CS_HZ, "~{0!~}\n~{0\"~}x\n", 0, 15, exp);
+    }
+    {
+	/* the LF ends a base64 run without a '-' */
+	static const size_t exp[] = { 2, 3, 7, 8,  6, 7, 15, 16 };
+	LINES(CS_UTF7, "+AGEAYg\nc+AGQ-e\nf", 0, 17, exp);
+    }
+    {
+	/* an encoded LF, which isn't the end of a base64 run */
+	static const size_t exp[] = { 1, 2, 1, 5 };
+	LINES(CS_UTF7, "a+AAoAYg-", 0, 9, exp);
+    }
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif
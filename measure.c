@@ -0,0 +1,237 @@
+/*
+ * measure.c - work out how long a conversion's output will be,
+ * without doing the conversion.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+struct measure_param {
+    size_t count;
+    size_t errlen;
+};
+
+static void measure_unicode_emit(void *ctx, long int output)
+{
+    struct measure_param *param = (struct measure_param *)ctx;
+
+    param->count += (output == ERROR ? param->errlen : 1);
+}
+
+static void measure_charset_emit(void *ctx, long int output)
+{
+    struct measure_param *param = (struct measure_param *)ctx;
+
+    UNUSEDARG(output);
+
+    param->count++;
+}
+
+size_t spec_measure_to_unicode(charset_spec const *spec,
+			       const char *input, size_t inlen,
+			       charset_state *state,
+			       const wchar_t *errstr, size_t errlen)
+{
+    charset_state localstate = CHARSET_INIT_STATE;
+    struct measure_param param;
+
+    param.count = 0;
+    param.errlen = (errstr ? errlen : 1);
+
+    if (state)
+	localstate = *state;	       /* structure copy */
+
+    while (inlen > 0) {
+	if (spec->read_count) {
+	    param.count += spec->read_count(spec, &input, &inlen,
+					    &localstate, param.errlen);
+	    if (inlen == 0)
+		break;
+	}
+
+	spec->read(spec, (unsigned char)*input, &localstate,
+		   measure_unicode_emit, &param);
+	input++;
+	inlen--;
+    }
+
+    if (state)
+	*state = localstate;	       /* structure copy */
+
+    return param.count;
+}
+
+size_t spec_measure_from_unicode(charset_spec const *spec,
+				 const wchar_t *input, size_t inlen,
+				 charset_state *state)
+{
+    charset_state localstate = CHARSET_INIT_STATE;
+    struct measure_param param;
+
+    param.count = 0;
+
+    if (state)
+	localstate = *state;	       /* structure copy */
+
+    if (!input) {
+	spec->write(spec, -1, &localstate, measure_charset_emit, &param);
+    } else {
+	while (inlen > 0) {
+	    if (spec->write_count) {
+		param.count += spec->write_count(spec, &input, &inlen,
+						 &localstate);
+		if (inlen == 0)
+		    break;
+	    }
+
+	    spec->write(spec, *input, &localstate,
+			measure_charset_emit, &param);
+	    input++;
+	    inlen--;
+	}
+    }
+
+    if (state)
+	*state = localstate;	       /* structure copy */
+
+    return param.count;
+}
+
+size_t charset_measure_to_unicode(const char *input, size_t inlen,
+				  int charset, charset_state *state,
+				  const wchar_t *errstr, size_t errlen)
+{
+    return spec_measure_to_unicode(charset_find_spec(charset), input, inlen,
+				   state, errstr, errlen);
+}
+
+size_t charset_measure_from_unicode(const wchar_t *input, size_t inlen,
+				    int charset, charset_state *state)
+{
+    return spec_measure_from_unicode(charset_find_spec(charset), input,
+				     inlen, state);
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int total_errs = 0;
+
+extern charset_spec const charset_CS_CTEXT;
+
+/*
+ * A small random number generator, so that the test does the same
+ * thing every time.
+ */
+static unsigned long rand_state = 1;
+static unsigned long rnd(unsigned long n)
+{
+    rand_state = rand_state * 1103515245UL + 12345UL;
+    return ((rand_state >> 8) & 0xFFFFFFUL) % n;
+}
+
+/*
+ * Characters chosen to make encoders switch about as much as
+ * possible: ASCII and controls, the right-hand halves of various
+ * SBCSes, characters found only in ISO 8859-14, ISO 8859-15 or
+ * Big5, CJK and Hangul, characters outside the BMP, and code
+ * points outside Unicode altogether.
+ */
+static const long int nasty[] = {
+    'a', '~', '\\', '+', '-', ' ', '\n', 0x1B, 0x0E, 0x85, 0xA0,
+    0xE9, 0x0151, 0x0434, 0x03B1, 0x05D0, 0x0627, 0x0E01,
+    0x1E02, 0x1E03, 0x0174, 0x20AC, 0x0160, 0x0152,
+    0x203E, 0x00A5, 0x2592,
+    0x3042, 0x30A2, 0x65E5, 0x4E2D, 0xD55C, 0xFF76, 0x2460, 0x256D,
+    0x5F9B, 0x7881, 0x9F98, 0xE000, 0xFFFD, 0xFFFF,
+    0x1F600, 0x10FFFD, 0x3FFFFFF, 0x7FFFFFFF,
+};
+
+/*
+ * Check that no character of a long random text makes `spec'
+ * write more than `maxbytes' bytes, that resetting the state at
+ * any point never takes more than `maxreset', and that no byte of
+ * the output, with some bytes spoilt, makes `spec' read more than
+ * `maxchars' characters.
+ */
+void bounds_test(int line, charset_spec const *spec)
+{
+    static const wchar_t errstr[] = { 0xFFFD };
+    static const char junk[] = "\x1b\x0e\x0f$()-%/@BG~{}+\x8e\xa1\xff";
+    charset_state state = CHARSET_INIT_STATE, st;
+    const size_t nchars = 20000;
+    wchar_t c;
+    char *enc;
+    size_t n, i, run = 0, enclen, maxb = 0, maxr = 0, maxc = 0;
+
+    enc = malloc(nchars * spec->maxbytes + spec->maxreset);
+    enclen = 0;
+
+    for (i = 0; i < nchars; i++) {
+	/*
+	 * Repeat characters now and then, to fill up the
+	 * length-encoded DOCS segments before leaving them.
+	 */
+	if (run == 0) {
+	    c = nasty[rnd(lenof(nasty))];
+	    run = 1 + rnd(2) * rnd(6);
+	}
+	run--;
+	st = state;		       /* structure copy */
+	n = spec_measure_from_unicode(spec, NULL, 0, &st);
+	if (n > maxr)
+	    maxr = n;
+	st = state;		       /* structure copy */
+	n = spec_measure_from_unicode(spec, &c, 1, &st);
+	if (n > maxb)
+	    maxb = n;
+	{
+	    const wchar_t *p = &c;
+	    size_t len = 1;
+
+	    enclen += spec_from_unicode(spec, &p, &len, enc + enclen,
+					n, &state, NULL, NULL);
+	}
+    }
+
+    for (i = 0; i < enclen; i++)
+	if (rnd(50) == 0)
+	    enc[i] = junk[rnd(sizeof(junk) - 1)];
+    state = charset_init_state;
+    for (i = 0; i < enclen; i++) {
+	n = spec_measure_to_unicode(spec, enc + i, 1, &state,
+				    errstr, lenof(errstr));
+	if (n > maxc)
+	    maxc = n;
+    }
+
+    if (maxb > (size_t)spec->maxbytes || maxr > (size_t)spec->maxreset ||
+	maxc > (size_t)spec->maxchars) {
+	printf("%d: charset %d needed (%d, %d, %d), limits (%d, %d, %d)\n",
+	       line, spec->charset, (int)maxb, (int)maxr, (int)maxc,
+	       spec->maxbytes, spec->maxreset, spec->maxchars);
+	total_errs++;
+    }
+
+    free(enc);
+}
+
+int main(void)
+{
+    charset_spec const *spec;
+    int cs;
+
+    printf("bounds tests beginning\n");
+    for (cs = 0; cs < 256; cs++)
+	if ((spec = charset_find_spec(cs)) != NULL)
+	    bounds_test(__LINE__, spec);
+    bounds_test(__LINE__, &charset_CS_CTEXT);
+    printf("bounds tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
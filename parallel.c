@@ -0,0 +1,537 @@
+/*
+ * parallel.c - convert large inputs in several pieces at once.
+ */
+
+#include <stdlib.h>
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * Below this size, a piece isn't worth handing to another thread.
+ */
+#define MINCHUNK 65536
+
+struct chunk {
+    size_t start, len;		       /* input span */
+    charset_state instate, outstate;
+    size_t outpos, outlen;	       /* output span */
+};
+
+struct decode_job {
+    charset_spec const *spec;
+    const char *input;
+    wchar_t *output;
+    const wchar_t *errstr;
+    size_t errlen;
+    struct chunk *chunks;
+};
+
+static int same_state(charset_state const *a, charset_state const *b)
+{
+    return a->s0 == b->s0 && a->s1 == b->s1;
+}
+
+static void decode_measure_chunk(struct decode_job *job, struct chunk *c)
+{
+    c->outstate = c->instate;	       /* structure copy */
+    c->outlen = spec_measure_to_unicode(job->spec, job->input + c->start,
+					c->len, &c->outstate,
+					job->errstr, job->errlen);
+}
+
+static void decode_measure_job(void *ctx, size_t i)
+{
+    struct decode_job *job = (struct decode_job *)ctx;
+
+    decode_measure_chunk(job, &job->chunks[i]);
+}
+
+static void decode_job(void *ctx, size_t i)
+{
+    struct decode_job *job = (struct decode_job *)ctx;
+    struct chunk *c = &job->chunks[i];
+    const char *input = job->input + c->start;
+    size_t inlen = c->len;
+    charset_state state = c->instate;  /* structure copy */
+
+    spec_to_unicode(job->spec, &input, &inlen, job->output + c->outpos,
+		    c->outlen, &state, job->errstr, job->errlen,
+		    NULL, NULL, NULL, NULL, NULL);
+}
+
+struct encode_job {
+    charset_spec const *spec;
+    const wchar_t *input;
+    char *output;
+    struct chunk *chunks;
+};
+
+static void encode_measure_job(void *ctx, size_t i)
+{
+    struct encode_job *job = (struct encode_job *)ctx;
+    struct chunk *c = &job->chunks[i];
+
+    c->outstate = c->instate;	       /* structure copy */
+    c->outlen = spec_measure_from_unicode(job->spec, job->input + c->start,
+					  c->len, &c->outstate);
+}
+
+static void encode_job(void *ctx, size_t i)
+{
+    struct encode_job *job = (struct encode_job *)ctx;
+    struct chunk *c = &job->chunks[i];
+    const wchar_t *input = job->input + c->start;
+    size_t inlen = c->len;
+    charset_state state = c->instate;  /* structure copy */
+
+    spec_from_unicode(job->spec, &input, &inlen, job->output + c->outpos,
+		      c->outlen, &state, NULL, NULL);
+}
+
+static void count_emit(void *ctx, long int output)
+{
+    UNUSEDARG(output);
+
+    (*(size_t *)ctx)++;
+}
+
+/*
+ * A chunk of encoder input was measured starting from the initial
+ * state, but really it starts in the state `truestate' left by the
+ * chunk before. Encoding the same characters from two different
+ * states usually ends up in the same state after a character or
+ * two (as soon as both have had to select the same character set,
+ * say), and from then on the output is identical. So we run both
+ * until they agree, and correct the chunk's output length by the
+ * difference between what they output up to there. If they never
+ * agree, we've measured the whole chunk properly anyway.
+ */
+static void encode_fix_chunk(struct encode_job *job, struct chunk *c,
+			     charset_state const *truestate)
+{
+    charset_spec const *spec = job->spec;
+    const wchar_t *input = job->input + c->start;
+    charset_state a = *truestate, b = c->instate;   /* structure copy */
+    size_t i, na = 0, nb = 0;
+
+    for (i = 0; i < c->len && !same_state(&a, &b); i++) {
+	spec->write(spec, input[i], &a, count_emit, &na);
+	spec->write(spec, input[i], &b, count_emit, &nb);
+    }
+
+    if (same_state(&a, &b))
+	c->outlen = c->outlen - nb + na;
+    else {
+	c->outlen = na;
+	c->outstate = a;	       /* structure copy */
+    }
+    c->instate = *truestate;	       /* structure copy */
+}
+
+static void run_jobs(const charset_runner *runner, size_t njobs,
+		     void (*fn)(void *ctx, size_t i), void *ctx)
+{
+    size_t i;
+
+    if (runner->run) {
+	runner->run(runner->ctx, njobs, fn, ctx);
+    } else {
+	for (i = 0; i < njobs; i++)
+	    fn(ctx, i);
+    }
+}
+
+/*
+ * Divide the input into about `want' chunks at points where the
+ * charset can be picked up. Returns the number of chunks, or 0 if
+ * we can't allocate the array.
+ */
+static size_t divide(charset_spec const *spec, const unsigned char *input,
+		     size_t inlen, charset_state const *state, size_t want,
+		     struct chunk **chunksp)
+{
+    struct chunk *chunks;
+    size_t n, pos, next;
+
+    chunks = (struct chunk *)malloc(want * sizeof(struct chunk));
+    if (!chunks)
+	return 0;
+
+    chunks[0].start = 0;
+    chunks[0].instate = *state;	       /* structure copy */
+    for (n = 1; n < want; n++) {
+	/*
+	 * Each search starts from the previous chunk boundary, since
+	 * we know the state there; charsets such as ISO-2022 have to
+	 * look at everything from their starting point onwards.
+	 */
+	size_t prev = chunks[n-1].start;
+	charset_state st = chunks[n-1].instate;   /* structure copy */
+
+	pos = inlen / want * n;
+	if (pos <= prev)
+	    pos = prev + 1;
+	next = prev + spec->sync(spec, input + prev, inlen - prev,
+				 pos - prev, &st);
+	if (next >= inlen)
+	    break;
+	chunks[n].start = next;
+	chunks[n].instate = st;	       /* structure copy */
+	chunks[n-1].len = next - chunks[n-1].start;
+    }
+    chunks[n-1].len = inlen - chunks[n-1].start;
+
+    *chunksp = chunks;
+    return n;
+}
+
+size_t charset_to_unicode_parallel(const char **input, size_t *inlen,
+				   wchar_t *output, size_t outlen,
+				   int charset, charset_state *state,
+				   const wchar_t *errstr, size_t errlen,
+				   const charset_runner *runner)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state localstate = CHARSET_INIT_STATE;
+    struct decode_job job;
+    struct chunk *chunks;
+    size_t i, n, want, total, ndone;
+
+    want = (runner ? runner->nworkers : 1);
+    if (want > *inlen / MINCHUNK)
+	want = *inlen / MINCHUNK;
+    if (want < 2 || !spec->sync)
+	return spec_to_unicode(spec, input, inlen, output, outlen, state,
+			       errstr, errlen, NULL, NULL, NULL, NULL, NULL);
+
+    if (state)
+	localstate = *state;	       /* structure copy */
+    n = divide(spec, (const unsigned char *)*input, *inlen, &localstate,
+	       want, &chunks);
+    if (n == 0)
+	return spec_to_unicode(spec, input, inlen, output, outlen, state,
+			       errstr, errlen, NULL, NULL, NULL, NULL, NULL);
+
+    job.spec = spec;
+    job.input = *input;
+    job.output = output;
+    job.errstr = errstr;
+    job.errlen = errlen;
+    job.chunks = chunks;
+
+    /*
+     * Find out how much output each chunk will produce, so that we
+     * know where in the output buffer to put it.
+     */
+    run_jobs(runner, n, decode_measure_job, &job);
+
+    /*
+     * Check that each chunk really does start in the state the
+     * previous one finished in. If it doesn't (which it shouldn't
+     * ever fail to), measure it again from the right state, so
+     * that the output is always exactly as if we'd done the whole
+     * lot in one go.
+     */
+    total = 0;
+    for (i = 0; i < n; i++) {
+	if (i > 0 && !same_state(&chunks[i].instate, &chunks[i-1].outstate)) {
+	    chunks[i].instate = chunks[i-1].outstate;
+	    decode_measure_chunk(&job, &chunks[i]);
+	}
+	chunks[i].outpos = total;
+	total += chunks[i].outlen;
+    }
+
+    /*
+     * Convert the chunks which fit in the output buffer in
+     * parallel, and then as much of the next one as will fit.
+     */
+    for (ndone = 0; ndone < n; ndone++)
+	if (outlen != CHARSET_UNBOUNDED &&
+	    chunks[ndone].outpos + chunks[ndone].outlen > outlen)
+	    break;
+    if (output)
+	run_jobs(runner, ndone, decode_job, &job);
+
+    if (ndone == n) {
+	*input += *inlen;
+	*inlen = 0;
+	localstate = chunks[n-1].outstate;   /* structure copy */
+    } else {
+	*input += chunks[ndone].start;
+	*inlen -= chunks[ndone].start;
+	total = chunks[ndone].outpos;
+	localstate = chunks[ndone].instate;  /* structure copy */
+	total += spec_to_unicode(spec, input, inlen,
+				 (output ? output + total : NULL),
+				 outlen - total, &localstate,
+				 errstr, errlen, NULL, NULL, NULL, NULL, NULL);
+    }
+    if (state)
+	*state = localstate;	       /* structure copy */
+
+    free(chunks);
+    return total;
+}
+
+size_t charset_from_unicode_parallel(const wchar_t **input, size_t *inlen,
+				     char *output, size_t outlen,
+				     int charset, charset_state *state,
+				     const charset_runner *runner)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state localstate = CHARSET_INIT_STATE;
+    charset_state initstate = CHARSET_INIT_STATE;
+    struct encode_job job;
+    struct chunk *chunks;
+    size_t i, n, total, ndone;
+
+    n = (runner ? runner->nworkers : 1);
+    if (input && n > *inlen / MINCHUNK)
+	n = *inlen / MINCHUNK;
+    if (!input || n < 2 ||
+	(chunks = (struct chunk *)malloc(n * sizeof(struct chunk))) == NULL)
+	return spec_from_unicode(spec, input, inlen, output, outlen, state,
+				 NULL, NULL);
+
+    if (state)
+	localstate = *state;	       /* structure copy */
+
+    /*
+     * Unicode can be divided anywhere. Measure each chunk as if it
+     * started from the initial state.
+     */
+    for (i = 0; i < n; i++) {
+	chunks[i].start = *inlen / n * i;
+	chunks[i].len = (i+1 < n ? *inlen / n * (i+1) : *inlen) -
+	    chunks[i].start;
+	chunks[i].instate = initstate; /* structure copy */
+    }
+
+    job.spec = spec;
+    job.input = *input;
+    job.output = output;
+    job.chunks = chunks;
+
+    run_jobs(runner, n, encode_measure_job, &job);
+
+    /*
+     * Now correct each chunk for the state it really starts in,
+     * and lay them out in the output.
+     */
+    total = 0;
+    for (i = 0; i < n; i++) {
+	charset_state const *truestate =
+	    (i > 0 ? &chunks[i-1].outstate : &localstate);
+
+	if (!same_state(truestate, &chunks[i].instate))
+	    encode_fix_chunk(&job, &chunks[i], truestate);
+	chunks[i].outpos = total;
+	total += chunks[i].outlen;
+    }
+
+    /*
+     * Convert the chunks which fit in the output buffer in
+     * parallel, and then as much of the next one as will fit.
+     */
+    for (ndone = 0; ndone < n; ndone++)
+	if (outlen != CHARSET_UNBOUNDED &&
+	    chunks[ndone].outpos + chunks[ndone].outlen > outlen)
+	    break;
+    if (output)
+	run_jobs(runner, ndone, encode_job, &job);
+
+    if (ndone == n) {
+	*input += *inlen;
+	*inlen = 0;
+	localstate = chunks[n-1].outstate;   /* structure copy */
+    } else {
+	*input += chunks[ndone].start;
+	*inlen -= chunks[ndone].start;
+	total = chunks[ndone].outpos;
+	localstate = chunks[ndone].instate;  /* structure copy */
+	total += spec_from_unicode(spec, input, inlen,
+				   (output ? output + total : NULL),
+				   outlen - total, &localstate, NULL, NULL);
+    }
+    if (state)
+	*state = localstate;	       /* structure copy */
+
+    free(chunks);
+    return total;
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <string.h>
+
+int total_errs = 0;
+
+/*
+ * A runner which does the jobs backwards, so that nothing can come
+ * to depend on them being run in order.
+ */
+static void backwards_run(void *ctx, size_t njobs,
+			  void (*job)(void *jobctx, size_t i), void *jobctx)
+{
+    UNUSEDARG(ctx);
+    while (njobs-- > 0)
+	job(jobctx, njobs);
+}
+
+static const charset_runner backwards = { backwards_run, NULL, 4 };
+static const charset_runner serial = { NULL, NULL, 3 };
+static const charset_runner *const runners[] = { &backwards, &serial };
+
+/*
+ * Check that charset_to_unicode_parallel() decodes `input' exactly
+ * as charset_to_unicode_sz() does, given `outlen' characters of
+ * output buffer and given only a quarter of that.
+ */
+void decode_test(int line, int charset, const char *input, size_t inlen,
+		 size_t outlen)
+{
+    wchar_t *wout1, *wout2;
+    size_t r;
+    int i;
+
+    wout1 = malloc(outlen * sizeof(wchar_t));
+    wout2 = malloc(outlen * sizeof(wchar_t));
+
+    for (r = 0; r < lenof(runners); r++) {
+	for (i = 0; i < 2; i++) {
+	    charset_state st1 = CHARSET_INIT_STATE;
+	    charset_state st2 = CHARSET_INIT_STATE;
+	    const char *p1 = input, *p2 = input;
+	    size_t left1 = inlen, left2 = inlen, ret1, ret2, n;
+
+	    n = (i == 0 ? outlen : outlen / 4 + 1);
+	    ret1 = charset_to_unicode_parallel(&p1, &left1, wout1, n,
+					       charset, &st1, NULL, 0,
+					       runners[r]);
+	    ret2 = charset_to_unicode_sz(&p2, &left2, wout2, n,
+					 charset, &st2, NULL, 0);
+	    if (ret1 != ret2 || left1 != left2 ||
+		memcmp(wout1, wout2, ret1 * sizeof(wchar_t)) ||
+		memcmp(&st1, &st2, sizeof(st1))) {
+		printf("%d: (%d,%d) parallel decode gave %d with %d left, "
+		       "should be %d with %d left\n", line, (int)r, i,
+		       (int)ret1, (int)left1, (int)ret2, (int)left2);
+		total_errs++;
+	    }
+	}
+    }
+
+    free(wout1);
+    free(wout2);
+}
+
+/*
+ * Encode `text' into `charset', then check that the parallel
+ * routines in each direction give exactly what the serial ones do,
+ * given the whole output buffer and given only part of it.
+ */
+void parallel_test(int line, int charset, const wchar_t *text, size_t len)
+{
+    const wchar_t *p = text;
+    size_t left = len, enclen, r;
+    char *enc, *out1, *out2;
+    int i;
+
+    enc = malloc(len * 8);
+    out1 = malloc(len * 8);
+    out2 = malloc(len * 8);
+    enclen = charset_from_unicode_sz(&p, &left, enc, len * 8, charset,
+				     NULL, NULL);
+    enclen += charset_from_unicode_sz(NULL, NULL, enc + enclen,
+				      len * 8 - enclen, charset, NULL, NULL);
+
+    decode_test(line, charset, enc, enclen, len * 2);
+
+    for (r = 0; r < lenof(runners); r++) {
+	for (i = 0; i < 2; i++) {
+	    charset_state st1 = CHARSET_INIT_STATE;
+	    charset_state st2 = CHARSET_INIT_STATE;
+	    const wchar_t *p1 = text, *p2 = text;
+	    size_t left1 = len, left2 = len, ret1, ret2, n;
+
+	    n = (i == 0 ? len * 8 : enclen / 2 + 1);
+	    ret1 = charset_from_unicode_parallel(&p1, &left1, out1, n,
+						 charset, &st1, runners[r]);
+	    ret2 = charset_from_unicode_sz(&p2, &left2, out2, n,
+					   charset, &st2, NULL);
+	    if (ret1 != ret2 || left1 != left2 ||
+		memcmp(out1, out2, ret1) ||
+		memcmp(&st1, &st2, sizeof(st1))) {
+		printf("%d: (%d,%d) parallel encode gave %d with %d left, "
+		       "should be %d with %d left\n", line, (int)r, i,
+		       (int)ret1, (int)left1, (int)ret2, (int)left2);
+		total_errs++;
+	    }
+	}
+    }
+
+    free(enc);
+    free(out1);
+    free(out2);
+}
+
+int main(void)
+{
+    static const int charsets[] = {
+	CS_UTF8, CS_UTF16, CS_EUC_JP, CS_SHIFT_JIS, CS_BIG5,
+	CS_ISO2022_JP, CS_ISO2022_KR, CS_ISO2022, CS_HZ, CS_UTF7,
+    };
+    static const int corrupted[] = { CS_ISO2022_JP, CS_ISO2022 };
+    static const char junk[] = "\x1b\x0e\x0f\x8e\x9b\xff\x1b$\x1b(\x1b%";
+    static const long sample[] = {
+	'J', 'a', 'p', 'a', 'n', 'e', 's', 'e', ' ', '(',
+	0x65E5, 0x672C, 0x8A9E, ')', '\t', 0x3053, 0x3093, 0x306B,
+	0x3061, 0x306F, ',', ' ', 0x4E2D, 0x6587, ' ', 0xD55C, 0xAE00,
+	' ', 0x00E9, '\n', '+', '~', '\r', '\n',
+    };
+    size_t len = 300000, i, enclen;
+    wchar_t *text;
+    const wchar_t *p;
+    char *enc;
+    int j;
+
+    printf("parallel tests beginning\n");
+
+    /*
+     * A long text, with a character now and again which some of
+     * the charsets can't encode.
+     */
+    text = malloc(len * sizeof(wchar_t));
+    for (i = 0; i < len; i++)
+	text[i] = sample[(i + i / 1000) % lenof(sample)];
+    for (j = 0; j < lenof(charsets); j++)
+	parallel_test(__LINE__, charsets[j], text, len);
+
+    /*
+     * The same text with stray escapes, shifts and 8-bit bytes
+     * scattered through it, some of them cutting escape sequences
+     * short, so that the prescan has to end up in whatever state
+     * the serial decoder does after them.
+     */
+    enc = malloc(len * 8);
+    for (j = 0; j < lenof(corrupted); j++) {
+	p = text;
+	i = len;
+	enclen = charset_from_unicode_sz(&p, &i, enc, len * 8, corrupted[j],
+					 NULL, NULL);
+	for (i = 0; i < enclen; i += 997 + i % 101)
+	    enc[i] = junk[i % (sizeof(junk) - 1)];
+	decode_test(__LINE__, corrupted[j], enc, enclen, enclen);
+    }
+    free(enc);
+    free(text);
+
+    printf("parallel tests completed\n");
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
@@ -0,0 +1,420 @@
+/*
+ * reencode.c - keep the encoded form of a text up to date as the
+ * text is edited, re-encoding only around each edit.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * The number of Unicode characters we try to put in each block.
+ */
+#define REBLOCK 4096
+
+/*
+ * The text is encoded in blocks, each of which remembers the state
+ * the encoder was in when it started. An edit only changes the
+ * output from the block it's in up to the first block boundary
+ * after it at which the encoder turns out to be in the same state
+ * as it was before; from there on, the old output is still right.
+ */
+struct block {
+    size_t ustart, ulen;	       /* span of the Unicode text */
+    charset_state instate;
+    char *out;
+    size_t outlen;
+};
+
+struct charset_reencoder {
+    charset_spec const *spec;
+    struct block *blocks;
+    size_t nblocks;
+    size_t textlen;
+    size_t outlen;		       /* total over all blocks */
+    charset_state endstate;	       /* after the last block */
+};
+
+static int same_state(charset_state const *a, charset_state const *b)
+{
+    return a->s0 == b->s0 && a->s1 == b->s1;
+}
+
+/*
+ * Encode `ulen' characters of `text' from `ustart' into a new block
+ * starting in `*state', and leave `*state' as the state after it.
+ * Returns FALSE if we run out of memory.
+ */
+static int encode_block(charset_spec const *spec, const wchar_t *text,
+			size_t ustart, size_t ulen, charset_state *state,
+			struct block *b)
+{
+    charset_state st = *state;	       /* structure copy */
+    const wchar_t *p = text + ustart;
+    size_t plen = ulen;
+
+    b->ustart = ustart;
+    b->ulen = ulen;
+    b->instate = *state;	       /* structure copy */
+    b->outlen = spec_measure_from_unicode(spec, p, plen, &st);
+    b->out = (char *)malloc(b->outlen ? b->outlen : 1);
+    if (!b->out)
+	return FALSE;
+    spec_from_unicode(spec, &p, &plen, b->out, b->outlen, state, NULL, NULL);
+    return TRUE;
+}
+
+/*
+ * Append a block to a growing array of them.
+ */
+static int add_block(struct block **blocks, size_t *n, size_t *size,
+		     struct block const *b)
+{
+    if (*n == *size) {
+	size_t newsize = (*size < 8 ? 8 : *size * 2);
+	struct block *nb = (struct block *)
+	    realloc(*blocks, newsize * sizeof(struct block));
+	if (!nb)
+	    return FALSE;
+	*blocks = nb;
+	*size = newsize;
+    }
+    (*blocks)[(*n)++] = *b;	       /* structure copy */
+    return TRUE;
+}
+
+static void free_blocks(struct block *blocks, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+	free(blocks[i].out);
+    free(blocks);
+}
+
+/*
+ * Encode `text' from `u' up to `end' in blocks of REBLOCK
+ * characters, appending them to the array.
+ */
+static int encode_span(charset_spec const *spec, const wchar_t *text,
+		       size_t u, size_t end, charset_state *state,
+		       struct block **blocks, size_t *n, size_t *size)
+{
+    struct block b;
+
+    while (u < end) {
+	size_t len = (end - u < REBLOCK ? end - u : REBLOCK);
+
+	if (!encode_block(spec, text, u, len, state, &b))
+	    return FALSE;
+	if (!add_block(blocks, n, size, &b)) {
+	    free(b.out);
+	    return FALSE;
+	}
+	u += len;
+    }
+    return TRUE;
+}
+
+charset_reencoder *charset_reencoder_new(int charset,
+					 const wchar_t *text, size_t len)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state state = CHARSET_INIT_STATE;
+    charset_reencoder *re;
+    struct block *blocks = NULL;
+    size_t n = 0, size = 0, i;
+
+    if (!spec)
+	return NULL;
+
+    re = (charset_reencoder *)malloc(sizeof(charset_reencoder));
+    if (!re)
+	return NULL;
+    if (!encode_span(spec, text, 0, len, &state, &blocks, &n, &size)) {
+	free_blocks(blocks, n);
+	free(re);
+	return NULL;
+    }
+
+    re->spec = spec;
+    re->blocks = blocks;
+    re->nblocks = n;
+    re->textlen = len;
+    re->outlen = 0;
+    for (i = 0; i < n; i++)
+	re->outlen += blocks[i].outlen;
+    re->endstate = state;	       /* structure copy */
+    return re;
+}
+
+void charset_reencoder_free(charset_reencoder *re)
+{
+    free_blocks(re->blocks, re->nblocks);
+    free(re);
+}
+
+int charset_reencoder_edit(charset_reencoder *re,
+			   const wchar_t *text, size_t len,
+			   size_t pos, size_t dellen, size_t inslen)
+{
+    charset_spec const *spec = re->spec;
+    struct block *old = re->blocks, *blocks = NULL;
+    size_t nold = re->nblocks, n = 0, size = 0;
+    size_t lo, hi, first, j, k, u;
+    charset_state init = CHARSET_INIT_STATE, state;
+
+    if (pos > re->textlen || dellen > re->textlen - pos ||
+	len != re->textlen - dellen + inslen)
+	return FALSE;
+
+    /*
+     * The first block affected is the one containing `pos'. The
+     * first one which might not need re-encoding is the first
+     * after it which begins beyond the deleted text.
+     */
+    lo = 0;
+    hi = nold;
+    while (hi - lo > 1) {
+	size_t mid = lo + (hi - lo) / 2;
+	if (old[mid].ustart <= pos)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    first = lo;
+    j = first + 1;
+    while (j < nold && old[j].ustart < pos + dellen)
+	j++;
+    if (nold == 0)
+	j = 0;			       /* the text was empty */
+
+    /*
+     * Re-encode up to the start of old block j (where it now is in
+     * the new text), and see if the state there is what it was. If
+     * not, that block needs doing again too, and so on.
+     */
+    if (nold > 0) {
+	u = old[first].ustart;
+	state = old[first].instate;    /* structure copy */
+    } else {
+	u = 0;
+	state = init;		       /* structure copy */
+    }
+    while (1) {
+	size_t end = (j < nold ? old[j].ustart - dellen + inslen : len);
+
+	if (!encode_span(spec, text, u, end, &state, &blocks, &n, &size)) {
+	    free_blocks(blocks, n);
+	    return FALSE;
+	}
+	u = end;
+	if (j == nold || same_state(&state, &old[j].instate))
+	    break;
+	j++;
+    }
+
+    /*
+     * Splice the new blocks in place of old ones `first' to j-1,
+     * making room first so that nothing can go wrong once we start.
+     */
+    if (n > j - first) {
+	struct block *nb = (struct block *)
+	    realloc(old, (nold - (j - first) + n) * sizeof(struct block));
+	if (!nb) {
+	    free_blocks(blocks, n);
+	    return FALSE;
+	}
+	old = re->blocks = nb;
+    }
+    for (k = first; k < j; k++) {
+	re->outlen -= old[k].outlen;
+	free(old[k].out);
+    }
+    for (k = 0; k < n; k++)
+	re->outlen += blocks[k].outlen;
+    for (k = j; k < nold; k++)
+	old[k].ustart = old[k].ustart - dellen + inslen;
+    if (j < nold)
+	memmove(old + first + n, old + j, (nold - j) * sizeof(struct block));
+    if (n > 0)
+	memcpy(old + first, blocks, n * sizeof(struct block));
+    free(blocks);
+
+    re->blocks = old;
+    re->nblocks = nold - (j - first) + n;
+    re->textlen = len;
+    if (j == nold)
+	re->endstate = state;	       /* structure copy */
+    return TRUE;
+}
+
+size_t charset_reencoder_output(charset_reencoder *re,
+				char *output, size_t outlen)
+{
+    charset_state state = re->endstate;   /* structure copy */
+    size_t total, resetlen, i;
+
+    resetlen = spec_from_unicode(re->spec, NULL, NULL, NULL,
+				 CHARSET_UNBOUNDED, &state, NULL, NULL);
+    total = re->outlen + resetlen;
+
+    if (output && (outlen == CHARSET_UNBOUNDED || outlen >= total)) {
+	for (i = 0; i < re->nblocks; i++) {
+	    memcpy(output, re->blocks[i].out, re->blocks[i].outlen);
+	    output += re->blocks[i].outlen;
+	}
+	state = re->endstate;	       /* structure copy */
+	spec_from_unicode(re->spec, NULL, NULL, output, resetlen,
+			  &state, NULL, NULL);
+    }
+
+    return total;
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <wchar.h>
+
+int total_errs = 0;
+
+/*
+ * A small random number generator, so that the test does the same
+ * thing every time.
+ */
+static unsigned long rand_state = 1;
+static size_t rnd(size_t n)
+{
+    rand_state = rand_state * 1103515245UL + 12345UL;
+    return ((rand_state >> 8) & 0xFFFFFFUL) % n;
+}
+
+/*
+ * Check that the reencoder's output is what encoding `text' from
+ * scratch gives.
+ */
+void check_output(int line, int charset, charset_reencoder *re,
+		  const wchar_t *text, size_t len, int edit)
+{
+    static char out1[1 << 20], out2[1 << 20];
+    charset_state state = CHARSET_INIT_STATE;
+    const wchar_t *p = text;
+    size_t left = len, len1, len2;
+
+    len1 = charset_reencoder_output(re, out1, sizeof(out1));
+    len2 = charset_from_unicode_sz(&p, &left, out2, sizeof(out2),
+				   charset, &state, NULL);
+    len2 += charset_from_unicode_sz(NULL, NULL, out2 + len2,
+				    sizeof(out2) - len2, charset, &state,
+				    NULL);
+    if (len1 != len2 || memcmp(out1, out2, len1)) {
+	printf("%d: after edit %d, output differs (%d vs %d bytes)\n",
+	       line, edit, (int)len1, (int)len2);
+	total_errs++;
+    }
+}
+
+/*
+ * Make `nedits' random edits to a text of about `len' characters
+ * drawn from `chars', checking the reencoder's output after each.
+ * Edits are often placed just before or after a block boundary,
+ * where the state the next block starts in is most likely to
+ * change. If `bigedits', some edits delete or insert thousands of
+ * characters at once.
+ */
+void edit_test(int line, int charset, const wchar_t *chars, size_t len,
+	       int nedits, int bigedits)
+{
+    static wchar_t text[1 << 16], ins[1 << 13];
+    size_t nchars = wcslen(chars), pos, dellen, inslen, i;
+    charset_reencoder *re;
+    int edit;
+
+    for (i = 0; i < len; i++)
+	text[i] = chars[rnd(nchars)];
+    re = charset_reencoder_new(charset, text, len);
+    check_output(line, charset, re, text, len, 0);
+
+    for (edit = 1; edit <= nedits; edit++) {
+	if (rnd(2) && len > REBLOCK) {
+	    pos = REBLOCK * (1 + rnd(len / REBLOCK));
+	    pos -= rnd(4);
+	    if (pos > len)
+		pos = len;
+	} else
+	    pos = rnd(len + 1);
+	dellen = rnd(4);
+	inslen = rnd(4);
+	if (bigedits && rnd(4) == 0) {
+	    if (rnd(2))
+		dellen = rnd(2 * REBLOCK);
+	    else
+		inslen = rnd(2 * REBLOCK);
+	}
+	if (dellen > len - pos)
+	    dellen = len - pos;
+	if (len - dellen + inslen > lenof(text))
+	    inslen = 0;
+
+	for (i = 0; i < inslen; i++)
+	    ins[i] = chars[rnd(nchars)];
+	memmove(text + pos + inslen, text + pos + dellen,
+		(len - pos - dellen) * sizeof(wchar_t));
+	memcpy(text + pos, ins, inslen * sizeof(wchar_t));
+	len = len - dellen + inslen;
+
+	if (!charset_reencoder_edit(re, text, len, pos, dellen, inslen)) {
+	    printf("%d: edit %d failed\n", line, edit);
+	    total_errs++;
+	    break;
+	}
+	check_output(line, charset, re, text, len, edit);
+    }
+
+    /* An edit which doesn't fit the text should be refused. */
+    if (charset_reencoder_edit(re, text, len + 1, len, 0, 2)) {
+	printf("%d: bad edit accepted\n", line);
+	total_errs++;
+    }
+
+    charset_reencoder_free(re);
+}
+
+int main(void)
+{
+    /*
+     * Mixtures of characters which need different shift states,
+     * with plenty of ASCII to bring the encoder back to where it
+     * started.
+     */
+    static const wchar_t japanese[] =
+	L"abc  \n\x65E5\x672C\x8A9E\x3053\x3093\x306B\x3061\x306F\xFF76\xE9";
+    static const wchar_t chinese[] = L"ab ~\n\x4E2D\x6587\x5B57\x7B26\xE9";
+    static const wchar_t mixed[] = L"ab+-~ \n\x65E5\x4E2D\xE9\x20AC";
+    /*
+     * Text with no ASCII at all. In UTF-7 the alignment of the
+     * base64 bits at a block boundary depends on how many
+     * characters came before, so an edit which changes that never
+     * converges and re-encodes to the end.
+     */
+    static const wchar_t kanji[] = L"\x65E5\x672C\x8A9E";
+
+    printf("reencode tests beginning\n");
+    edit_test(__LINE__, CS_ISO2022_JP, japanese, 20000, 300, TRUE);
+    edit_test(__LINE__, CS_UTF7, mixed, 20000, 300, TRUE);
+    edit_test(__LINE__, CS_HZ, chinese, 20000, 300, TRUE);
+    edit_test(__LINE__, CS_UTF8, mixed, 20000, 100, TRUE);
+    edit_test(__LINE__, CS_UTF7, kanji, 20000, 100, FALSE);
+    edit_test(__LINE__, CS_ISO2022_JP, kanji, 20000, 100, FALSE);
+    edit_test(__LINE__, CS_ISO2022_JP, japanese, 0, 20, FALSE);
+    edit_test(__LINE__, CS_UTF7, mixed, 10, 50, TRUE);
+    printf("reencode tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
@@ -70,3 +70,146 @@ int write_sbcs(charset_spec const *charset, long int input_chr,
     emit(emitctx, ret);
     return TRUE;
 }
+
+/*
+ * Block versions of the above. Reading is a straight table lookup
+ * per byte, which we can do without any function calls at all;
+ * writing still needs the binary search, but saves the emit
+ * overhead. In SBCSes which are supersets of ASCII, runs of ASCII
+ * are simply copied in either direction.
+ */
+
+size_t read_sbcs_block(charset_spec const *charset,
+		       const char **input, size_t *inlen,
+		       charset_state *state, wchar_t *output, size_t outlen)
+{
+    const struct sbcs_data *sd = charset->data;
+    const unsigned char *p = (const unsigned char *)*input;
+    int ascii = (charset->flags & CSF_ASCII);
+    size_t i, n;
+
+    UNUSEDARG(state);
+
+    n = (*inlen < outlen ? *inlen : outlen);
+    i = 0;
+    while (i < n) {
+	unsigned long c;
+
+	if (ascii && p[i] < 0x80) {
+	    const unsigned char *q = p + i;
+	    i += ascii_widen(&q, n - i, output + i, n - i);
+	    continue;
+	}
+	c = sd->sbcs2ucs[p[i]];
+	if (c == ERROR)
+	    break;
+	output[i++] = c;
+    }
+
+    *input += i;
+    *inlen -= i;
+    return i;
+}
+
+size_t write_sbcs_block(charset_spec const *charset,
+			const wchar_t **input, size_t *inlen,
+			charset_state *state, char *output, size_t outlen)
+{
+    const struct sbcs_data *sd = charset->data;
+    const wchar_t *p = *input;
+    int ascii = (charset->flags & CSF_ASCII);
+    size_t i, n;
+
+    UNUSEDARG(state);
+
+    n = (*inlen < outlen ? *inlen : outlen);
+    i = 0;
+    while (i < n) {
+	long int c;
+
+	if (p[i] < 0)
+	    break;
+	if (ascii && p[i] < 0x80) {
+	    const wchar_t *q = p + i;
+	    i += ascii_narrow(&q, n - i, output + i, n - i);
+	    continue;
+	}
+	c = sbcs_from_unicode(sd, p[i]);
+	if (c == ERROR)
+	    break;
+	output[i++] = c;
+    }
+
+    *input += i;
+    *inlen -= i;
+    return i;
+}
+
+/*
+ * Counting versions. Every input byte produces exactly one
+ * character or one error, so unless the error string is an
+ * unusual length we needn't even look at the input.
+ */
+
+size_t read_sbcs_count(charset_spec const *charset,
+		       const char **input, size_t *inlen,
+		       charset_state *state, size_t errlen)
+{
+    const struct sbcs_data *sd = charset->data;
+    const unsigned char *p = (const unsigned char *)*input;
+    size_t i, n = *inlen, count;
+
+    UNUSEDARG(state);
+
+    if (errlen == 1) {
+	count = n;
+    } else {
+	count = 0;
+	for (i = 0; i < n; i++)
+	    count += (sd->sbcs2ucs[p[i]] == ERROR ? errlen : 1);
+    }
+
+    *input += n;
+    *inlen = 0;
+    return count;
+}
+
+size_t write_sbcs_count(charset_spec const *charset,
+			const wchar_t **input, size_t *inlen,
+			charset_state *state)
+{
+    const struct sbcs_data *sd = charset->data;
+    const wchar_t *p = *input;
+    int ascii = (charset->flags & CSF_ASCII);
+    size_t i, n = *inlen, count = 0;
+
+    UNUSEDARG(state);
+
+    for (i = 0; i < n; i++) {
+	if (p[i] < 0)
+	    break;
+	if (p[i] < 0x80 && ascii)
+	    count++;
+	else if (sbcs_from_unicode(sd, p[i]) != ERROR)
+	    count++;
+    }
+
+    *input += i;
+    *inlen -= i;
+    return count;
+}
+
+/*
+ * An SBCS can be picked up anywhere, since the state never
+ * changes.
+ */
+size_t sync_sbcs(charset_spec const *charset,
+		 const unsigned char *input, size_t inlen, size_t pos,
+		 charset_state *state)
+{
+    UNUSEDARG(charset);
+    UNUSEDARG(input);
+    UNUSEDARG(state);
+
+    return (pos < inlen ? pos : inlen);
+}
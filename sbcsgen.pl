@@ -96,7 +96,7 @@ close BAR;
 
 sub outcharset($$$) {
     my ($name, $vals, $sortpriority) = @_;
-    my ($prefix, $i, @sorted);
+    my ($prefix, $i, @sorted, $flags);
 
     print "const sbcs_data sbcsdata_$name = {\n";
     print "    {\n";
@@ -134,8 +134,42 @@ sub outcharset($$$) {
 	}
 	$j++;
     }
-    printf "\n    },\n    %d\n", $j;
+    printf "\n    },\n    %d,\n    {\n", $j;
+    $prefix = "    ";
+    for ($i = 0; $i < 8; $i++) {
+	my $word = 0;
+	for ($j = 0; $j < 32; $j++) {
+	    $word |= 1 << $j if $vals->[$i*32+$j] >= 0;
+	}
+	printf "%s0x%08x", $prefix, $word;
+	$prefix = ($i == 3 ? ",\n    " : ", ");
+    }
+    print "\n    },\n    {\n";
+    $prefix = "    ";
+    for ($i = 0; $i < 256; $i++) {
+	my @utf8 = &utf8($vals->[$i]);
+	printf "%s{%s}", $prefix, join ",", map { sprintf "0x%02x", $_ } @utf8;
+	$prefix = ($i % 3 == 2 ? ",\n    " : ", ");
+    }
+    print "\n    }\n";
     print "};\n";
+    $flags = "CSF_STATELESS | CSF_SELFSYNC";
+    $flags .= " | CSF_ASCII" unless grep { $vals->[$_] != $_ } 0..127;
     print "const charset_spec charset_$name = {\n" .
-          "    $name, read_sbcs, write_sbcs, &sbcsdata_$name\n};\n\n";
+          "    $name, read_sbcs, write_sbcs, &sbcsdata_$name,\n" .
+          "    read_sbcs_block, write_sbcs_block, read_sbcs_count, write_sbcs_count,\n" .
+          "    NULL, NULL, sync_sbcs,\n" .
+          "    1, 0, 1, $flags\n};\n\n";
+}
+
+# The UTF-8 encoding of a table entry, padded to four bytes, or a
+# lead byte of 0xFF for an undefined one.
+sub utf8($) {
+    my ($c) = @_;
+    return (0xFF, 0, 0, 0) if $c < 0;
+    return ($c, 0, 0, 0) if $c < 0x80;
+    return (0xC0 | ($c >> 6), 0x80 | ($c & 0x3F), 0, 0) if $c < 0x800;
+    die sprintf "SBCS maps to U+%04X outside the BMP\n", $c if $c >= 0x10000;
+    return (0xE0 | ($c >> 12), 0x80 | (($c >> 6) & 0x3F),
+	    0x80 | ($c & 0x3F), 0);
 }
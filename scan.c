@@ -0,0 +1,543 @@
+/*
+ * scan.c - fast scanning of input for the first byte (or code
+ * unit) that needs more careful attention.
+ *
+ * These (with scanavx2.c and scanavx512.c) are the only functions
+ * in the library which know about particular CPUs. Each comes in
+ * several versions: plain C, which looks at an unsigned long at a
+ * time; SSE2, which looks at 16 bytes at a time, if the compiler
+ * tells us SSE2 is available; and AVX2 and AVX-512 versions, if
+ * those files were compiled with the flags to enable them. Which
+ * set we use is decided the first time one is wanted, by asking
+ * the CPU what it supports.
+ *
+ * For testing and benchmarking, the environment variable
+ * LIBCHARSET_SIMD can name a set to use instead: `scalar', `sse2',
+ * `avx2' or `avx512'. If the one named isn't available, we use the
+ * best one that is which comes before it in that list. Any other
+ * non-empty value (a misspelling, or a name like `sse4.2' which we
+ * don't have a set for) gets the plain C versions.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "charset.h"
+#include "internal.h"
+
+#if defined __SSE2__ || defined _M_X64 || \
+    (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if (defined __i386__ || defined __x86_64__) && \
+    (defined __clang__ || __GNUC__ > 4 || \
+     (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#define HAVE_CPU_SUPPORTS
+#endif
+
+static size_t ascii_span_scalar(const unsigned char *p, size_t len)
+{
+    const unsigned long hibits = ~0UL / 0xFF * 0x80;
+    size_t i = 0;
+
+    while (len - i >= sizeof(unsigned long)) {
+	unsigned long w;
+	memcpy(&w, p + i, sizeof(w));
+	if (w & hibits)
+	    break;
+	i += sizeof(w);
+    }
+
+    while (i < len && p[i] < 0x80)
+	i++;
+    return i;
+}
+
+static size_t utf16_plain_span_scalar(const unsigned char *p, size_t len,
+				      int bigendian)
+{
+    size_t i = 0;
+    int hi = (bigendian ? 0 : 1);
+
+    while (len - i >= 2 && (p[i+hi] & 0xF8) != 0xD8 &&
+	   (p[i] & p[i+1]) != 0xFF)
+	i += 2;
+    return i;
+}
+
+static size_t ascii_widen_scalar(const unsigned char **input, size_t inlen,
+				 wchar_t *output, size_t outlen)
+{
+    const unsigned char *p = *input;
+    size_t i = 0, n = (inlen < outlen ? inlen : outlen);
+
+    while (i < n && p[i] < 0x80) {
+	output[i] = p[i];
+	i++;
+    }
+    *input = p + i;
+    return i;
+}
+
+static size_t ascii_narrow_scalar(const wchar_t **input, size_t inlen,
+				  char *output, size_t outlen)
+{
+    const wchar_t *p = *input;
+    size_t i = 0, n = (inlen < outlen ? inlen : outlen);
+
+    while (i < n && (unsigned long)p[i] < 0x80) {
+	output[i] = (char)p[i];
+	i++;
+    }
+    *input = p + i;
+    return i;
+}
+
+static const struct scan_kernels kernels_scalar = {
+    "scalar",
+    ascii_span_scalar, utf16_plain_span_scalar,
+    ascii_widen_scalar, ascii_narrow_scalar
+};
+
+#ifdef USE_SSE2
+
+static size_t ascii_span_sse2(const unsigned char *p, size_t len)
+{
+    size_t i = 0;
+
+    while (len - i >= 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+	if (_mm_movemask_epi8(v))
+	    break;
+	i += 16;
+    }
+
+    while (i < len && p[i] < 0x80)
+	i++;
+    return i;
+}
+
+static size_t utf16_plain_span_sse2(const unsigned char *p, size_t len,
+				    int bigendian)
+{
+    size_t i = 0;
+    int hi = (bigendian ? 0 : 1);
+    const __m128i f8 = _mm_set1_epi8((char)0xF8);
+    const __m128i d8 = _mm_set1_epi8((char)0xD8);
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    int himask = (bigendian ? 0x5555 : 0xAAAA);
+
+    while (len - i >= 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+	__m128i s = _mm_cmpeq_epi8(_mm_and_si128(v, f8), d8);
+	if ((_mm_movemask_epi8(s) & himask) |
+	    _mm_movemask_epi8(_mm_cmpeq_epi16(v, ones)))
+	    break;
+	i += 16;
+    }
+
+    while (len - i >= 2 && (p[i+hi] & 0xF8) != 0xD8 &&
+	   (p[i] & p[i+1]) != 0xFF)
+	i += 2;
+    return i;
+}
+
+static size_t ascii_widen_sse2(const unsigned char **input, size_t inlen,
+			       wchar_t *output, size_t outlen)
+{
+    const unsigned char *p = *input;
+    size_t i = 0, n = (inlen < outlen ? inlen : outlen);
+    const __m128i zero = _mm_setzero_si128();
+
+    if (sizeof(wchar_t) == 4 || sizeof(wchar_t) == 2) {
+	while (n - i >= 16) {
+	    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+	    __m128i lo, hi;
+	    __m128i *out = (__m128i *)(output + i);
+
+	    if (_mm_movemask_epi8(v))
+		break;
+	    lo = _mm_unpacklo_epi8(v, zero);
+	    hi = _mm_unpackhi_epi8(v, zero);
+	    if (sizeof(wchar_t) == 2) {
+		_mm_storeu_si128(out, lo);
+		_mm_storeu_si128(out + 1, hi);
+	    } else {
+		_mm_storeu_si128(out, _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi, zero));
+	    }
+	    i += 16;
+	}
+    }
+
+    while (i < n && p[i] < 0x80) {
+	output[i] = p[i];
+	i++;
+    }
+    *input = p + i;
+    return i;
+}
+
+static size_t ascii_narrow_sse2(const wchar_t **input, size_t inlen,
+				char *output, size_t outlen)
+{
+    const wchar_t *p = *input;
+    size_t i = 0, n = (inlen < outlen ? inlen : outlen);
+    const __m128i zero = _mm_setzero_si128();
+
+    if (sizeof(wchar_t) == 4) {
+	const __m128i hibits = _mm_set1_epi32(~0x7F);
+
+	while (n - i >= 16) {
+	    const __m128i *in = (const __m128i *)(p + i);
+	    __m128i a = _mm_loadu_si128(in), b = _mm_loadu_si128(in + 1);
+	    __m128i c = _mm_loadu_si128(in + 2), d = _mm_loadu_si128(in + 3);
+	    __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+
+	    if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, hibits),
+						  zero)) != 0xFFFF)
+		break;
+	    _mm_storeu_si128((__m128i *)(output + i),
+			     _mm_packus_epi16(_mm_packs_epi32(a, b),
+					      _mm_packs_epi32(c, d)));
+	    i += 16;
+	}
+    } else if (sizeof(wchar_t) == 2) {
+	const __m128i hibits = _mm_set1_epi16(~0x7F);
+
+	while (n - i >= 16) {
+	    const __m128i *in = (const __m128i *)(p + i);
+	    __m128i a = _mm_loadu_si128(in), b = _mm_loadu_si128(in + 1);
+	    __m128i any = _mm_or_si128(a, b);
+
+	    if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(any, hibits),
+						  zero)) != 0xFFFF)
+		break;
+	    _mm_storeu_si128((__m128i *)(output + i), _mm_packus_epi16(a, b));
+	    i += 16;
+	}
+    }
+
+    while (i < n && (unsigned long)p[i] < 0x80) {
+	output[i] = (char)p[i];
+	i++;
+    }
+    *input = p + i;
+    return i;
+}
+
+static const struct scan_kernels kernels_sse2 = {
+    "sse2",
+    ascii_span_sse2, utf16_plain_span_sse2,
+    ascii_widen_sse2, ascii_narrow_sse2
+};
+
+#endif /* USE_SSE2 */
+
+enum { TIER_SCALAR, TIER_SSE2, TIER_AVX2, TIER_AVX512, NTIERS };
+
+/*
+ * Return the kernels for a tier, if they were compiled in and the
+ * CPU can run them, or NULL.
+ */
+static const struct scan_kernels *tier_kernels(int tier)
+{
+    switch (tier) {
+      case TIER_SCALAR:
+	return &kernels_scalar;
+#ifdef USE_SSE2
+      case TIER_SSE2:
+	return &kernels_sse2;
+#endif
+#ifdef HAVE_CPU_SUPPORTS
+      case TIER_AVX2:
+	__builtin_cpu_init();
+	if (scan_kernels_avx2 && __builtin_cpu_supports("avx2"))
+	    return scan_kernels_avx2;
+	break;
+      case TIER_AVX512:
+	__builtin_cpu_init();
+	if (scan_kernels_avx512 && __builtin_cpu_supports("avx512f") &&
+	    __builtin_cpu_supports("avx512bw"))
+	    return scan_kernels_avx512;
+	break;
+#endif
+    }
+    return NULL;
+}
+
+/*
+ * Choose the kernels to use, given the value of LIBCHARSET_SIMD
+ * (which may be NULL).
+ */
+static const struct scan_kernels *choose_kernels(const char *forced)
+{
+    static const char *const names[NTIERS] = {
+	"scalar", "sse2", "avx2", "avx512"
+    };
+    const struct scan_kernels *k = NULL;
+    int tier = NTIERS - 1;
+
+    if (forced && *forced) {
+	/* a name we don't know gets the scalar code */
+	while (tier > TIER_SCALAR && strcmp(forced, names[tier]))
+	    tier--;
+    }
+
+    for (; tier >= TIER_SCALAR; tier--)
+	if ((k = tier_kernels(tier)) != NULL)
+	    break;
+    return k;
+}
+
+/*
+ * The kernels in use, once chosen. Two threads might both choose
+ * them at once, but they'll choose the same ones, so it doesn't
+ * matter which of them writes this last.
+ */
+static const struct scan_kernels *kernels;
+
+static const struct scan_kernels *get_kernels(void)
+{
+    if (!kernels)
+	kernels = choose_kernels(getenv("LIBCHARSET_SIMD"));
+    return kernels;
+}
+
+const char *charset_simd_tier(void)
+{
+    return get_kernels()->name;
+}
+
+/*
+ * Return the length of the initial run of bytes in `p' which are
+ * less than 0x80.
+ */
+size_t ascii_span(const unsigned char *p, size_t len)
+{
+    return get_kernels()->ascii_span(p, len);
+}
+
+/*
+ * Return the length in bytes of the initial run of whole UTF-16
+ * code units in `p' which are not surrogates or U+FFFF (which
+ * read_utf16 reports as an error). `bigendian' says which byte of
+ * each unit is the high one.
+ */
+size_t utf16_plain_span(const unsigned char *p, size_t len, int bigendian)
+{
+    return get_kernels()->utf16_plain_span(p, len, bigendian);
+}
+
+/*
+ * Like ascii_span, but also stopping at any of the (ASCII)
+ * characters in the string `stops'. We look at the input a window
+ * at a time, so that finding a stop near the start doesn't cost us
+ * a scan of everything after it.
+ */
+size_t ascii_span_except(const unsigned char *p, size_t len,
+			 const char *stops)
+{
+    size_t i = 0, n, w;
+    const char *s;
+
+    while (i < len) {
+	w = (len - i < 256 ? len - i : 256);
+	n = ascii_span(p + i, w);
+	for (s = stops; *s && n > 0; s++) {
+	    const unsigned char *q = memchr(p + i, *s, n);
+	    if (q)
+		n = q - (p + i);
+	}
+	i += n;
+	if (n < w)
+	    break;
+    }
+    return i;
+}
+
+/*
+ * Copy the initial run of ASCII in `*input' to `output', widening
+ * it to wchar_t as we go, stopping after at most `outlen'
+ * characters. Advances `*input', and returns the number of
+ * characters copied.
+ */
+size_t ascii_widen(const unsigned char **input, size_t inlen,
+		   wchar_t *output, size_t outlen)
+{
+    return get_kernels()->ascii_widen(input, inlen, output, outlen);
+}
+
+/*
+ * The reverse: copy the initial run of characters below 0x80 in
+ * `*input' to `output' as bytes, stopping after at most `outlen'
+ * of them. Advances `*input', and returns the number of bytes
+ * output.
+ */
+size_t ascii_narrow(const wchar_t **input, size_t inlen,
+		    char *output, size_t outlen)
+{
+    return get_kernels()->ascii_narrow(input, inlen, output, outlen);
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+
+int total_errs = 0;
+
+/*
+ * Check that choose_kernels() picks `tier' given LIBCHARSET_SIMD
+ * set to `forced', or the best available tier below it.
+ */
+void choose_test(int line, const char *forced, int tier)
+{
+    const struct scan_kernels *k = choose_kernels(forced), *exp;
+
+    while ((exp = tier_kernels(tier)) == NULL)
+	tier--;
+    if (k != exp) {
+	printf("%d: LIBCHARSET_SIMD=%s chose %s, expected %s\n",
+	       line, forced ? forced : "(unset)", k->name, exp->name);
+	total_errs++;
+    }
+}
+
+/*
+ * Check each of `k''s kernels against the scalar ones, at every
+ * alignment within 32 bytes and every length up to a bit more than
+ * two of the widest vectors, with the byte (or unit) which stops
+ * them at every position.
+ */
+void kernel_test(const struct scan_kernels *k)
+{
+    static const unsigned char stops[] = { 0x80, 0xFF };
+    static const long int wstops[] = { 0x80, 0x100, 0x10041 };
+    static const unsigned char hwstops[][2] = {
+	{ 0xD8, 0x00 }, { 0xDF, 0xFF }, { 0xFF, 0xFF },
+    };
+    const struct scan_kernels *s = &kernels_scalar;
+    unsigned char buf[200];
+    wchar_t wbuf[200], out1[200], out2[200];
+    char nout1[200], nout2[200];
+    size_t align, len, pos, i, ret1, ret2;
+    int errs = total_errs;
+
+    for (align = 0; align < 32 && errs == total_errs; align++) {
+	unsigned char *p = buf + align;
+	wchar_t *wp = wbuf + (align % 16);
+
+	for (len = 0; len <= 136 && errs == total_errs; len++) {
+	    for (pos = 0; pos <= len; pos++) {
+		for (i = 0; i < len; i++)
+		    p[i] = (unsigned char)(' ' + i % 90);
+
+		for (i = 0; i < lenof(stops); i++) {
+		    const unsigned char *q1 = p, *q2 = p;
+
+		    if (pos < len)
+			p[pos] = stops[i];
+		    if (s->ascii_span(p, len) != k->ascii_span(p, len)) {
+			printf("%s: ascii_span(%d, %d) stop at %d differs\n",
+			       k->name, (int)align, (int)len, (int)pos);
+			total_errs++;
+		    }
+		    ret1 = s->ascii_widen(&q1, len, out1, len - pos / 2);
+		    ret2 = k->ascii_widen(&q2, len, out2, len - pos / 2);
+		    if (ret1 != ret2 || q1 != q2 ||
+			memcmp(out1, out2, ret1 * sizeof(wchar_t))) {
+			printf("%s: ascii_widen(%d, %d) stop at %d differs\n",
+			       k->name, (int)align, (int)len, (int)pos);
+			total_errs++;
+		    }
+		}
+
+		for (i = 0; i < lenof(hwstops); i++) {
+		    int be;
+
+		    for (be = 0; be < 2; be++) {
+			size_t at = pos & ~(size_t)1;
+
+			if (at + 1 < len) {
+			    p[at + (be ? 0 : 1)] = hwstops[i][0];
+			    p[at + (be ? 1 : 0)] = hwstops[i][1];
+			}
+			if (s->utf16_plain_span(p, len, be) !=
+			    k->utf16_plain_span(p, len, be)) {
+			    printf("%s: utf16_plain_span(%d, %d, %d) stop at "
+				   "%d differs\n", k->name, (int)align,
+				   (int)len, be, (int)pos);
+			    total_errs++;
+			}
+			for (at = 0; at < len; at++)
+			    p[at] = (unsigned char)(' ' + at % 90);
+		    }
+		}
+
+		if (len > 128 || align >= 16)
+		    continue;
+		for (i = 0; i < lenof(wstops); i++) {
+		    const wchar_t *q1 = wp, *q2 = wp;
+		    size_t j;
+
+		    for (j = 0; j < len; j++)
+			wp[j] = ' ' + j % 90;
+		    if (pos < len)
+			wp[pos] = wstops[i];
+		    ret1 = s->ascii_narrow(&q1, len, nout1, len - pos / 2);
+		    ret2 = k->ascii_narrow(&q2, len, nout2, len - pos / 2);
+		    if (ret1 != ret2 || q1 != q2 || memcmp(nout1, nout2, ret1)) {
+			printf("%s: ascii_narrow(%d, %d) stop at %d differs\n",
+			       k->name, (int)align, (int)len, (int)pos);
+			total_errs++;
+		    }
+		}
+	    }
+	}
+    }
+}
+
+int main(void)
+{
+    const char *forced = getenv("LIBCHARSET_SIMD");
+    int tier;
+
+    /*
+     * charset_simd_tier() reports what LIBCHARSET_SIMD asked for.
+     * Run this with it set to each tier name in turn to check them
+     * all against the CPU.
+     */
+    if (strcmp(charset_simd_tier(), choose_kernels(forced)->name)) {
+	printf("charset_simd_tier() gave %s with LIBCHARSET_SIMD=%s\n",
+	       charset_simd_tier(), forced ? forced : "(unset)");
+	total_errs++;
+    }
+    choose_test(__LINE__, NULL, NTIERS - 1);
+    choose_test(__LINE__, "", NTIERS - 1);
+    choose_test(__LINE__, "scalar", TIER_SCALAR);
+    choose_test(__LINE__, "sse2", TIER_SSE2);
+    choose_test(__LINE__, "avx2", TIER_AVX2);
+    choose_test(__LINE__, "avx512", TIER_AVX512);
+    choose_test(__LINE__, "sse4.2", TIER_SCALAR);
+    choose_test(__LINE__, "AVX2", TIER_SCALAR);
+    choose_test(__LINE__, "avx", TIER_SCALAR);
+    choose_test(__LINE__, "avx5122", TIER_SCALAR);
+
+    for (tier = TIER_SSE2; tier < NTIERS; tier++) {
+	const struct scan_kernels *k = tier_kernels(tier);
+
+	if (k) {
+	    printf("testing %s against scalar\n", k->name);
+	    kernel_test(k);
+	}
+    }
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
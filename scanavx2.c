@@ -0,0 +1,152 @@
+/*
+ * scanavx2.c - the scanning functions from scan.c, for CPUs with
+ * AVX2, looking at 32 bytes at a time. This file must be compiled
+ * with the flags to enable AVX2 (-mavx2 for gcc); otherwise it
+ * provides nothing, and scan.c won't use it.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+#ifdef __AVX2__
+
+#include <immintrin.h>
+
+static size_t ascii_span_avx2(const unsigned char *p, size_t len)
+{
+    size_t i = 0;
+
+    while (len - i >= 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+	if (_mm256_movemask_epi8(v))
+	    break;
+	i += 32;
+    }
+
+    while (i < len && p[i] < 0x80)
+	i++;
+    return i;
+}
+
+static size_t utf16_plain_span_avx2(const unsigned char *p, size_t len,
+				    int bigendian)
+{
+    size_t i = 0;
+    int hi = (bigendian ? 0 : 1);
+    const __m256i f8 = _mm256_set1_epi8((char)0xF8);
+    const __m256i d8 = _mm256_set1_epi8((char)0xD8);
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    unsigned himask = (bigendian ? 0x55555555U : 0xAAAAAAAAU);
+
+    while (len - i >= 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+	__m256i s = _mm256_cmpeq_epi8(_mm256_and_si256(v, f8), d8);
+	if (((unsigned)_mm256_movemask_epi8(s) & himask) |
+	    _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, ones)))
+	    break;
+	i += 32;
+    }
+
+    while (len - i >= 2 && (p[i+hi] & 0xF8) != 0xD8 &&
+	   (p[i] & p[i+1]) != 0xFF)
+	i += 2;
+    return i;
+}
+
+static size_t ascii_widen_avx2(const unsigned char **input, size_t inlen,
+			       wchar_t *output, size_t outlen)
+{
+    const unsigned char *p = *input;
+    size_t i = 0, n = (inlen < outlen ? inlen : outlen);
+
+    if (sizeof(wchar_t) == 4 || sizeof(wchar_t) == 2) {
+	while (n - i >= 16) {
+	    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+	    __m256i *out = (__m256i *)(output + i);
+
+	    if (_mm_movemask_epi8(v))
+		break;
+	    if (sizeof(wchar_t) == 2) {
+		_mm256_storeu_si256(out, _mm256_cvtepu8_epi16(v));
+	    } else {
+		__m128i hi = _mm_srli_si128(v, 8);
+
+		_mm256_storeu_si256(out, _mm256_cvtepu8_epi32(v));
+		_mm256_storeu_si256(out + 1, _mm256_cvtepu8_epi32(hi));
+	    }
+	    i += 16;
+	}
+    }
+
+    while (i < n && p[i] < 0x80) {
+	output[i] = p[i];
+	i++;
+    }
+    *input = p + i;
+    return i;
+}
+
+static size_t ascii_narrow_avx2(const wchar_t **input, size_t inlen,
+				char *output, size_t outlen)
+{
+    const wchar_t *p = *input;
+    size_t i = 0, n = (inlen < outlen ? inlen : outlen);
+
+    /*
+     * The pack instructions work within each 128-bit half, so the
+     * result has its middle two quarters swapped, which the
+     * permute puts right.
+     */
+    if (sizeof(wchar_t) == 4) {
+	const __m256i hibits = _mm256_set1_epi32(~0x7F);
+
+	while (n - i >= 16) {
+	    const __m256i *in = (const __m256i *)(p + i);
+	    __m256i a = _mm256_loadu_si256(in), b = _mm256_loadu_si256(in + 1);
+	    __m256i w;
+
+	    if (!_mm256_testz_si256(_mm256_or_si256(a, b), hibits))
+		break;
+	    w = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+	    _mm_storeu_si128((__m128i *)(output + i),
+			     _mm_packus_epi16(_mm256_castsi256_si128(w),
+					      _mm256_extracti128_si256(w, 1)));
+	    i += 16;
+	}
+    } else if (sizeof(wchar_t) == 2) {
+	const __m256i hibits = _mm256_set1_epi16(~0x7F);
+
+	while (n - i >= 32) {
+	    const __m256i *in = (const __m256i *)(p + i);
+	    __m256i a = _mm256_loadu_si256(in), b = _mm256_loadu_si256(in + 1);
+
+	    if (!_mm256_testz_si256(_mm256_or_si256(a, b), hibits))
+		break;
+	    _mm256_storeu_si256((__m256i *)(output + i),
+				_mm256_permute4x64_epi64(
+				    _mm256_packus_epi16(a, b), 0xD8));
+	    i += 32;
+	}
+    }
+
+    while (i < n && (unsigned long)p[i] < 0x80) {
+	output[i] = (char)p[i];
+	i++;
+    }
+    *input = p + i;
+    return i;
+}
+
+static const struct scan_kernels kernels_avx2 = {
+    "avx2",
+    ascii_span_avx2, utf16_plain_span_avx2,
+    ascii_widen_avx2, ascii_narrow_avx2
+};
+
+const struct scan_kernels *const scan_kernels_avx2 = &kernels_avx2;
+
+#else
+
+const struct scan_kernels *const scan_kernels_avx2 = NULL;
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * scanavx512.c - the scanning functions from scan.c, for CPUs with
+ * AVX-512 (the F and BW subsets), looking at 64 bytes at a time.
+ * This file must be compiled with the flags to enable those
+ * (-mavx512f -mavx512bw for gcc); otherwise it provides nothing,
+ * and scan.c won't use it.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+#if defined __AVX512F__ && defined __AVX512BW__
+
+#include <immintrin.h>
+
+static size_t ascii_span_avx512(const unsigned char *p, size_t len)
+{
+    size_t i = 0;
+
+    while (len - i >= 64) {
+	__m512i v = _mm512_loadu_si512((const void *)(p + i));
+	if (_mm512_movepi8_mask(v))
+	    break;
+	i += 64;
+    }
+
+    while (i < len && p[i] < 0x80)
+	i++;
+    return i;
+}
+
+static size_t utf16_plain_span_avx512(const unsigned char *p, size_t len,
+				      int bigendian)
+{
+    size_t i = 0;
+    int hi = (bigendian ? 0 : 1);
+    /*
+     * Compare whole 16-bit lanes, with the masks placed on
+     * whichever byte of each is the high one.
+     */
+    const __m512i f8 = _mm512_set1_epi16(bigendian ? 0x00F8 : 0xF800);
+    const __m512i d8 = _mm512_set1_epi16(bigendian ? 0x00D8 : 0xD800);
+    const __m512i ones = _mm512_set1_epi16(-1);
+
+    while (len - i >= 64) {
+	__m512i v = _mm512_loadu_si512((const void *)(p + i));
+	if (_mm512_cmpeq_epi16_mask(_mm512_and_si512(v, f8), d8) |
+	    _mm512_cmpeq_epi16_mask(v, ones))
+	    break;
+	i += 64;
+    }
+
+    while (len - i >= 2 && (p[i+hi] & 0xF8) != 0xD8 &&
+	   (p[i] & p[i+1]) != 0xFF)
+	i += 2;
+    return i;
+}
+
+static size_t ascii_widen_avx512(const unsigned char **input, size_t inlen,
+				 wchar_t *output, size_t outlen)
+{
+    const unsigned char *p = *input;
+    size_t i = 0, n = (inlen < outlen ? inlen : outlen);
+
+    if (sizeof(wchar_t) == 4) {
+	while (n - i >= 16) {
+	    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+
+	    if (_mm_movemask_epi8(v))
+		break;
+	    _mm512_storeu_si512((void *)(output + i), _mm512_cvtepu8_epi32(v));
+	    i += 16;
+	}
+    } else if (sizeof(wchar_t) == 2) {
+	while (n - i >= 32) {
+	    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+
+	    if (_mm256_movemask_epi8(v))
+		break;
+	    _mm512_storeu_si512((void *)(output + i), _mm512_cvtepu8_epi16(v));
+	    i += 32;
+	}
+    }
+
+    while (i < n && p[i] < 0x80) {
+	output[i] = p[i];
+	i++;
+    }
+    *input = p + i;
+    return i;
+}
+
+static size_t ascii_narrow_avx512(const wchar_t **input, size_t inlen,
+				  char *output, size_t outlen)
+{
+    const wchar_t *p = *input;
+    size_t i = 0, n = (inlen < outlen ? inlen : outlen);
+
+    if (sizeof(wchar_t) == 4) {
+	const __m512i hibits = _mm512_set1_epi32(~0x7F);
+
+	while (n - i >= 16) {
+	    __m512i a = _mm512_loadu_si512((const void *)(p + i));
+
+	    if (_mm512_test_epi32_mask(a, hibits))
+		break;
+	    _mm_storeu_si128((__m128i *)(output + i), _mm512_cvtepi32_epi8(a));
+	    i += 16;
+	}
+    } else if (sizeof(wchar_t) == 2) {
+	const __m512i hibits = _mm512_set1_epi16(~0x7F);
+
+	while (n - i >= 32) {
+	    __m512i a = _mm512_loadu_si512((const void *)(p + i));
+
+	    if (_mm512_test_epi16_mask(a, hibits))
+		break;
+	    _mm256_storeu_si256((__m256i *)(output + i),
+				_mm512_cvtepi16_epi8(a));
+	    i += 32;
+	}
+    }
+
+    while (i < n && (unsigned long)p[i] < 0x80) {
+	output[i] = (char)p[i];
+	i++;
+    }
+    *input = p + i;
+    return i;
+}
+
+static const struct scan_kernels kernels_avx512 = {
+    "avx512",
+    ascii_span_avx512, utf16_plain_span_avx512,
+    ascii_widen_avx512, ascii_narrow_avx512
+};
+
+const struct scan_kernels *const scan_kernels_avx512 = &kernels_avx512;
+
+#else
+
+const struct scan_kernels *const scan_kernels_avx512 = NULL;
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ * search.c - find a Unicode string in encoded text.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * How far back from a candidate match we ask the charset's `sync'
+ * function to look for a place where we know the decoding state.
+ */
+#define SYNCBACK 64
+
+static void discard_output(void *ctx, long int c, size_t offset)
+{
+    UNUSEDARG(ctx);
+    UNUSEDARG(c);
+    UNUSEDARG(offset);
+}
+
+/*
+ * Checking a candidate match: the characters decoded from the
+ * candidate's bytes must be exactly the needle, and the first must
+ * begin at the candidate's offset (not part-way through a
+ * character, as a Shift-JIS trail byte can look like an ASCII one).
+ */
+struct verify {
+    const wchar_t *needle;
+    size_t needlelen, matched;
+    size_t offset;		       /* of the candidate */
+    int failed;
+};
+
+static void verify_output(void *ctx, long int c, size_t offset)
+{
+    struct verify *v = (struct verify *)ctx;
+
+    if (offset < v->offset || v->matched == v->needlelen)
+	return;			       /* not part of the candidate */
+    if (c == ERROR)
+	c = 0xFFFD;		       /* U+FFFD REPLACEMENT CHARACTER */
+    if (v->needle[v->matched] != c)
+	v->failed = TRUE;
+    v->matched++;
+}
+
+static int search_bytes(charset_spec const *spec,
+			const unsigned char *hay, size_t len,
+			const wchar_t *needle, size_t needlelen,
+			const unsigned char *enc, size_t enclen,
+			size_t *offset)
+{
+    charset_state init = CHARSET_INIT_STATE;
+    struct source_feed walk;
+    size_t o, i;
+
+    /*
+     * `walk' is a decoder we move forward through the haystack to
+     * each candidate in turn, so that we know the state there. It
+     * jumps ahead using the charset's `sync' function where it can,
+     * and skips over ASCII where that stands for itself.
+     */
+    walk.spec = spec;
+    walk.state = init;		       /* structure copy */
+    walk.start = walk.pos = 0;
+    walk.output = discard_output;
+    walk.outctx = NULL;
+
+    for (o = 0; o + enclen <= len; o++) {
+	const unsigned char *p;
+	struct source_feed check;
+	struct verify v;
+
+	p = (const unsigned char *)memchr(hay + o, enc[0],
+					  len - enclen + 1 - o);
+	if (!p)
+	    break;
+	o = p - hay;
+	if (memcmp(p, enc, enclen))
+	    continue;
+
+	if (o > walk.pos + SYNCBACK) {
+	    charset_state st = walk.state;   /* structure copy */
+	    size_t r = walk.pos + spec->sync(spec, hay + walk.pos,
+					     o - walk.pos,
+					     o - SYNCBACK - walk.pos, &st);
+	    if (r < o) {
+		walk.pos = walk.start = r;
+		walk.state = st;       /* structure copy */
+	    }
+	}
+	while (walk.pos < o) {
+	    const char *stops;
+
+	    if (hay[walk.pos] < 0x80 &&
+		(stops = current_ascii_stops(spec, &walk.state)) != NULL) {
+		size_t n = ascii_span_except(hay + walk.pos, o - walk.pos,
+					     stops);
+		if (n > 0) {
+		    walk.pos += n;
+		    walk.start = walk.pos;
+		    continue;
+		}
+	    }
+	    source_feed_byte(&walk, hay[walk.pos], walk.pos);
+	    walk.pos++;
+	}
+
+	check = walk;		       /* structure copy */
+	v.needle = needle;
+	v.needlelen = needlelen;
+	v.matched = 0;
+	v.offset = o;
+	v.failed = FALSE;
+	check.output = verify_output;
+	check.outctx = &v;
+	for (i = 0; i < enclen && !v.failed; i++)
+	    source_feed_byte(&check, hay[o + i], o + i);
+	if (!v.failed && v.matched == needlelen) {
+	    *offset = o;
+	    return TRUE;
+	}
+    }
+
+    *offset = len;
+    return FALSE;
+}
+
+/*
+ * Searching the decoded text itself, by the Knuth-Morris-Pratt
+ * algorithm. `fail[j]' is the length of the longest proper prefix
+ * of the needle's first j+1 characters which is also a suffix of
+ * them; `offsets' remembers where in the input each of the last
+ * `needlelen' characters came from.
+ */
+struct kmp {
+    const wchar_t *needle;
+    size_t needlelen;
+    size_t *fail, *offsets;
+    size_t matched, count;
+    int found;
+    size_t foundat;
+};
+
+static void kmp_output(void *ctx, long int c, size_t offset)
+{
+    struct kmp *k = (struct kmp *)ctx;
+
+    if (k->found)
+	return;
+    if (c == ERROR)
+	c = 0xFFFD;		       /* U+FFFD REPLACEMENT CHARACTER */
+
+    k->offsets[k->count % k->needlelen] = offset;
+    k->count++;
+    while (k->matched > 0 && k->needle[k->matched] != c)
+	k->matched = k->fail[k->matched - 1];
+    if (k->needle[k->matched] == c)
+	k->matched++;
+    if (k->matched == k->needlelen) {
+	k->found = TRUE;
+	k->foundat = k->offsets[(k->count - k->needlelen) % k->needlelen];
+    }
+}
+
+static int search_decoded(charset_spec const *spec,
+			  const unsigned char *hay, size_t len,
+			  const wchar_t *needle, size_t needlelen,
+			  size_t *offset)
+{
+    charset_state init = CHARSET_INIT_STATE;
+    struct source_feed f;
+    struct kmp k;
+    size_t i, j;
+
+    k.fail = (size_t *)malloc(2 * needlelen * sizeof(size_t));
+    if (!k.fail) {
+	*offset = len;
+	return FALSE;
+    }
+    k.offsets = k.fail + needlelen;
+    k.needle = needle;
+    k.needlelen = needlelen;
+    k.matched = k.count = 0;
+    k.found = FALSE;
+
+    k.fail[0] = 0;
+    for (i = 1, j = 0; i < needlelen; i++) {
+	while (j > 0 && needle[i] != needle[j])
+	    j = k.fail[j - 1];
+	if (needle[i] == needle[j])
+	    j++;
+	k.fail[i] = j;
+    }
+
+    f.spec = spec;
+    f.state = init;		       /* structure copy */
+    f.start = 0;
+    f.output = kmp_output;
+    f.outctx = &k;
+    i = 0;
+    while (i < len && !k.found) {
+	const char *stops;
+
+	/*
+	 * ASCII which stands for itself can skip the decoder.
+	 */
+	if (hay[i] < 0x80 &&
+	    (stops = current_ascii_stops(spec, &f.state)) != NULL) {
+	    size_t n = ascii_span_except(hay + i, len - i, stops);
+	    if (n > 0) {
+		for (j = i; j < i + n && !k.found; j++)
+		    kmp_output(&k, hay[j], j);
+		i += n;
+		f.start = i;
+		continue;
+	    }
+	}
+	source_feed_byte(&f, hay[i], i);
+	i++;
+    }
+
+    free(k.fail);
+    *offset = (k.found ? k.foundat : len);
+    return k.found;
+}
+
+static int has_replacement(const wchar_t *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+	if (s[i] == 0xFFFD)
+	    return TRUE;
+    return FALSE;
+}
+
+int charset_search(int charset, const char *haystack, size_t len,
+		   const wchar_t *needle, size_t needlelen, size_t *offset)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    const unsigned char *hay = (const unsigned char *)haystack;
+    size_t result;
+    int found;
+
+    if (!offset)
+	offset = &result;
+    if (needlelen == 0) {
+	*offset = 0;
+	return TRUE;
+    }
+
+    /*
+     * In a stateless charset, the needle is always encoded the same
+     * way wherever it appears, so we can look for its bytes. (Unless
+     * it contains U+FFFD, which might stand for invalid input.)
+     */
+    if ((spec->flags & CSF_STATELESS) && spec->sync &&
+	!has_replacement(needle, needlelen)) {
+	const wchar_t *p = needle;
+	size_t plen = needlelen, enclen;
+	charset_state state = CHARSET_INIT_STATE;
+	unsigned char *enc;
+	int error = FALSE;
+
+	enclen = spec_measure_from_unicode(spec, needle, needlelen, &state);
+	enc = (unsigned char *)malloc(enclen ? enclen : 1);
+	if (enc) {
+	    charset_state state2 = CHARSET_INIT_STATE;
+
+	    spec_from_unicode(spec, &p, &plen, (char *)enc, enclen, &state2,
+			      &error, NULL);
+	    /*
+	     * If the needle can't be encoded, it can still turn up
+	     * if the decoder produces characters the encoder doesn't,
+	     * so we fall back to decoding.
+	     */
+	    if (!error && plen == 0) {
+		found = search_bytes(spec, hay, len, needle, needlelen,
+				     enc, enclen, offset);
+		free(enc);
+		return found;
+	    }
+	    free(enc);
+	}
+    }
+
+    return search_decoded(spec, hay, len, needle, needlelen, offset);
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <wchar.h>
+
+int total_errs = 0;
+
+/*
+ * The slow way: decode the whole haystack with its source offsets,
+ * and look for the needle in that.
+ */
+struct decoded {
+    wchar_t chars[4096];
+    size_t offsets[4096];
+    size_t n;
+};
+
+static void decoded_sink(void *ctx, const wchar_t *chars,
+			 const size_t *offsets, size_t n)
+{
+    struct decoded *d = (struct decoded *)ctx;
+
+    memcpy(d->chars + d->n, chars, n * sizeof(wchar_t));
+    memcpy(d->offsets + d->n, offsets, n * sizeof(size_t));
+    d->n += n;
+}
+
+/*
+ * Check charset_search against the slow way, and against what we
+ * expect (-1 meaning not found).
+ */
+void search_test(int line, int charset, const char *hay, size_t len,
+		 const wchar_t *needle, long expected)
+{
+    static struct decoded d;
+    size_t needlelen = wcslen(needle), i, offset;
+    long slow = -1;
+    int found;
+
+    d.n = 0;
+    charset_to_unicode_sink(hay, len, charset, NULL, NULL, 0,
+			    decoded_sink, &d);
+    for (i = 0; i + needlelen <= d.n; i++)
+	if (!memcmp(d.chars + i, needle, needlelen * sizeof(wchar_t))) {
+	    slow = (needlelen ? (long)d.offsets[i] : 0);
+	    break;
+	}
+
+    found = charset_search(charset, hay, len, needle, needlelen, &offset);
+    if (found != (expected >= 0) ||
+	(found ? (long)offset != expected : offset != len)) {
+	printf("%d: found=%d at %d, expected %ld\n", line, found,
+	       (int)offset, expected);
+	total_errs++;
+    }
+    if (slow != expected) {
+	printf("%d: decoding finds it at %ld, expected %ld\n", line,
+	       slow, expected);
+	total_errs++;
+    }
+}
+
+/* Macro to concoct the first four parameters of search_test. */
+#define TESTSTR(cs, x) __LINE__, cs, x, sizeof(x)-1
+
+int main(void)
+{
+    static char big[3001];
+    size_t i;
+
+    printf("search tests beginning\n");
+
+    /* Trail bytes which look like ASCII mustn't match ASCII. */
+    search_test(TESTSTR(CS_SHIFT_JIS, "\x83\x41"), L"A", -1);
+    search_test(TESTSTR(CS_SHIFT_JIS, "\x83\x41" "A"), L"A", 2);
+    search_test(TESTSTR(CS_SHIFT_JIS, "x\x83\x41" "A"), L"\x30A2" L"A", 1);
+    search_test(TESTSTR(CS_SHIFT_JIS, "\x83\x41\x83\x41"), L"A\x30A2", -1);
+    search_test(TESTSTR(CS_BIG5, "\xA4\x40"), L"@", -1);
+    search_test(TESTSTR(CS_BIG5, "\xA4\x40@"), L"@", 2);
+    search_test(TESTSTR(CS_BIG5, "\xA4\x40\xA4\x40" "a@"), L"a@", 4);
+    search_test(TESTSTR(CS_CP949, "\xB0\x41" "A"), L"A", 2);
+
+    /* Invalid input is matched by U+FFFD, so gets decoded. */
+    search_test(TESTSTR(CS_UTF8, "abc\xFF" "def"), L"c\xFFFD" L"d", 2);
+    search_test(TESTSTR(CS_SHIFT_JIS, "ab\x83 "), L"b\xFFFD", 1);
+
+    /* Needles the charset can't encode, and the empty needle. */
+    search_test(TESTSTR(CS_SHIFT_JIS, "caf\x82\x85"), L"\xE9", -1);
+    search_test(TESTSTR(CS_SHIFT_JIS, "abc"), L"", 0);
+
+    /* Stateful charsets fall back to decoding. */
+    search_test(TESTSTR(CS_ISO2022_JP, "\x1b$B%\"\x1b(B"), L"%", -1);
+    search_test(TESTSTR(CS_ISO2022_JP, "\x1b$B%\"\x1b(B%"), L"%", 8);
+    search_test(TESTSTR(CS_ISO2022_JP, "a\x1b$B%\"\x1b(Bb"),
+		L"\x30A2" L"b", 4);
+    search_test(TESTSTR(CS_HZ, "~{%\"~}%"), L"%", 6);
+    search_test(TESTSTR(CS_UTF16, "\0a\0b\x30\xA2"), L"b\x30A2", 2);
+    search_test(TESTSTR(CS_UTF7, "a+MKI-b"), L"\x30A2" L"b", 1);
+
+    /*
+     * A long run of Shift-JIS whose trail bytes all look like the
+     * needle, so that every one is a candidate and the walk has to
+     * use `sync' to keep up.
+     */
+    for (i = 0; i + 1 < sizeof(big); i += 2) {
+	big[i] = '\x83';
+	big[i+1] = 'A';
+    }
+    big[sizeof(big) - 1] = 'A';
+    search_test(__LINE__, CS_SHIFT_JIS, big, sizeof(big), L"A",
+		sizeof(big) - 1);
+    search_test(__LINE__, CS_SHIFT_JIS, big, sizeof(big) - 1, L"A", -1);
+    big[1001] = 'B';		       /* 83 42 is U+30A3 */
+    search_test(__LINE__, CS_SHIFT_JIS, big, sizeof(big), L"\x30A3", 1000);
+    big[1000] = 'A';		       /* ... and now it's "AB" */
+    search_test(__LINE__, CS_SHIFT_JIS, big, sizeof(big), L"AB", 1000);
+
+    printf("search tests completed\n");
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
@@ -8,7 +8,8 @@
 #include "internal.h"
 
 /*
- * Shift-JIS has no associated data, so `charset' may be ignored.
+ * The Shift-JIS read and write functions need no associated data (the
+ * spec's data is for dbcs.c), so `charset' may be ignored.
  */
 
 static void read_sjis(charset_spec const *charset, long int input_chr,
@@ -70,6 +71,26 @@ static void read_sjis(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * Shift-JIS lead bytes are 81-9F and E0-EF, for the shared functions
+ * in dbcs.c.
+ */
+static const struct dbcs_data sjis_data = {
+    { 0, 0, 0, 0, 0xFFFFFFFE, 0, 0, 0x0000FFFF }
+};
+
+/*
+ * Between characters, ASCII is ASCII in Shift-JIS, except that 5C
+ * and 7E are the yen sign and overline from JIS X 0201.
+ */
+static const char *ascii_stops_sjis(charset_spec const *charset,
+				    charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return (state->s0 == 0 ? "\\~" : NULL);
+}
+
 /*
  * Shift-JIS is a stateless multi-byte encoding (in the sense that
  * just after any character has been completed, the state is always
@@ -118,7 +139,10 @@ static int write_sjis(charset_spec const *charset, long int input_chr,
 }
 
 const charset_spec charset_CS_SHIFT_JIS = {
-    CS_SHIFT_JIS, read_sjis, write_sjis, NULL
+    CS_SHIFT_JIS, read_sjis, write_sjis, &sjis_data,
+    NULL, NULL, read_dbcs_count, NULL, midchar_dbcs,
+    ascii_stops_sjis, sync_dbcs,
+    2, 0, 1, CSF_STATELESS
 };
 
 #else /* ENUM_CHARSETS */
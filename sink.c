@@ -0,0 +1,194 @@
+/*
+ * sink.c - decode into a caller-supplied function, a block of
+ * characters at a time, instead of into a buffer.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+#define SINKBLOCK 256
+
+/*
+ * Feeding a decoder one byte at a time, and attributing each output
+ * character to the input sequence it came from. We can't tell which
+ * bytes an output came from until `read' has finished with the
+ * current byte, and then only for the last thing it emitted; so
+ * that one is held back in `pending' until we can.
+ */
+static void source_feed_emit(void *ctx, long int output)
+{
+    struct source_feed *f = (struct source_feed *)ctx;
+    size_t offset, length;
+
+    if (f->nemitted > 0) {
+	/*
+	 * Something emitted before this came from the sequence
+	 * preceding the current byte, whatever the decoder does
+	 * next.
+	 */
+	output_source(f->start, f->pos, FALSE, 0, 2, &offset, &length);
+	f->output(f->outctx, f->pending, offset);
+    }
+    f->pending = output;
+    f->nemitted++;
+}
+
+void source_feed_byte(struct source_feed *f, unsigned char c, size_t pos)
+{
+    size_t offset, length;
+    int partial;
+
+    f->nemitted = 0;
+    f->pos = pos;
+    f->spec->read(f->spec, c, &f->state, source_feed_emit, f);
+    partial = f->spec->midchar && f->spec->midchar(f->spec, &f->state);
+    if (f->nemitted > 0) {
+	output_source(f->start, pos, partial, f->nemitted - 1, f->nemitted,
+		      &offset, &length);
+	f->output(f->outctx, f->pending, offset);
+    }
+    if (!partial)
+	f->start = pos + 1;
+    else if (f->nemitted > 0)
+	f->start = pos;
+}
+
+struct sink_param {
+    void (*sink)(void *ctx, const wchar_t *chars, const size_t *offsets,
+		 size_t n);
+    void *sinkctx;
+    const wchar_t *errstr;
+    size_t errlen;
+    wchar_t chars[SINKBLOCK];
+    size_t offsets[SINKBLOCK];
+    size_t n;			       /* characters waiting in the block */
+    size_t total;		       /* characters passed to the sink */
+};
+
+static void sink_flush(struct sink_param *param)
+{
+    if (param->n > 0) {
+	param->sink(param->sinkctx, param->chars, param->offsets, param->n);
+	param->total += param->n;
+	param->n = 0;
+    }
+}
+
+static void sink_add(struct sink_param *param, wchar_t c, size_t offset)
+{
+    if (param->n == SINKBLOCK)
+	sink_flush(param);
+    param->chars[param->n] = c;
+    param->offsets[param->n] = offset;
+    param->n++;
+}
+
+static void sink_output(void *ctx, long int output, size_t offset)
+{
+    struct sink_param *param = (struct sink_param *)ctx;
+    size_t i;
+
+    if (output == ERROR) {
+	if (param->errstr) {
+	    for (i = 0; i < param->errlen; i++)
+		sink_add(param, param->errstr[i], offset);
+	} else {
+	    /* U+FFFD REPLACEMENT CHARACTER */
+	    sink_add(param, 0xFFFD, offset);
+	}
+    } else {
+	sink_add(param, output, offset);
+    }
+}
+
+size_t charset_to_unicode_sink(const char *input, size_t inlen,
+			       int charset, charset_state *state,
+			       const wchar_t *errstr, size_t errlen,
+			       void (*sink)(void *ctx, const wchar_t *chars,
+					    const size_t *offsets, size_t n),
+			       void *sinkctx)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state init = CHARSET_INIT_STATE;
+    struct sink_param param;
+    struct source_feed feed;
+    const unsigned char *p = (const unsigned char *)input;
+    size_t pos = 0, i;
+
+    param.sink = sink;
+    param.sinkctx = sinkctx;
+    param.errstr = errstr;
+    param.errlen = errlen;
+    param.n = 0;
+    param.total = 0;
+
+    feed.spec = spec;
+    feed.state = init;		       /* structure copy */
+    if (state)
+	feed.state = *state;	       /* structure copy */
+    feed.start = 0;
+    feed.output = sink_output;
+    feed.outctx = &param;
+
+    while (pos < inlen) {
+	const char *stops;
+
+	/*
+	 * An SBCS's block reader produces one character per byte, so
+	 * we know where each one came from. (The other block readers
+	 * don't, so they aren't any use to us here.)
+	 */
+	if (spec->read == read_sbcs && spec->read_block) {
+	    const char *q = input + pos;
+	    size_t n = inlen - pos, ret;
+
+	    if (n > SINKBLOCK - param.n)
+		n = SINKBLOCK - param.n;
+	    ret = spec->read_block(spec, &q, &n, &feed.state,
+				   param.chars + param.n, SINKBLOCK - param.n);
+	    for (i = 0; i < ret; i++)
+		param.offsets[param.n + i] = pos + i;
+	    param.n += ret;
+	    pos += ret;
+	    feed.start = pos;
+	    if (param.n == SINKBLOCK)
+		sink_flush(&param);
+	    if (ret > 0)
+		continue;
+	}
+
+	/*
+	 * Likewise a run of ASCII, if it currently stands for itself.
+	 */
+	if (p[pos] < 0x80) {
+	    stops = current_ascii_stops(spec, &feed.state);
+	    if (stops) {
+		size_t n = inlen - pos;
+		const unsigned char *q = p + pos;
+
+		if (n > SINKBLOCK - param.n)
+		    n = SINKBLOCK - param.n;
+		n = ascii_span_except(q, n, stops);
+		if (n > 0) {
+		    ascii_widen(&q, n, param.chars + param.n, n);
+		    for (i = 0; i < n; i++)
+			param.offsets[param.n + i] = pos + i;
+		    param.n += n;
+		    pos += n;
+		    feed.start = pos;
+		    if (param.n == SINKBLOCK)
+			sink_flush(&param);
+		    continue;
+		}
+	    }
+	}
+
+	source_feed_byte(&feed, p[pos], pos);
+	pos++;
+    }
+
+    sink_flush(&param);
+    if (state)
+	*state = feed.state;	       /* structure copy */
+    return param.total;
+}
@@ -32,3 +32,21 @@ int charset_exists(int charset)
 {
     return charset_find_spec(charset) != NULL;
 }
+
+int charset_info(int charset, struct charset_info *info)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+
+    if (!spec)
+	return FALSE;
+
+    info->max_bytes_per_char = spec->maxbytes;
+    info->max_reset_bytes = spec->maxreset;
+    info->max_chars_per_byte = spec->maxchars;
+    info->stateless = (spec->flags & CSF_STATELESS) != 0;
+    info->self_synchronising = (spec->flags & CSF_SELFSYNC) != 0;
+    info->ascii_superset = (spec->flags & CSF_ASCII) != 0;
+    info->needs_reset = (spec->flags & CSF_RESET) != 0;
+
+    return TRUE;
+}
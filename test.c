@@ -12,13 +12,11 @@
 int main(int argc, char **argv)
 {
     int srcset, dstset;
-    charset_state instate = CHARSET_INIT_STATE;
-    charset_state outstate = CHARSET_INIT_STATE;
+    charset_converter *conv;
     char inbuf[256], outbuf[256];
-    wchar_t midbuf[256];
     const char *inptr;
-    const wchar_t *midptr;
-    int rdret, inlen, midlen, inret, midret;
+    size_t inlen, outret;
+    int rdret;
 
     if (argc != 3) {
 	fprintf(stderr, "usage: convcs <charset> <charset>\n");
@@ -37,6 +35,13 @@ int main(int argc, char **argv)
 	return 1;
     }
 
+    conv = charset_converter_new(srcset, dstset);
+    if (!conv) {
+	fprintf(stderr, "unable to create converter\n");
+	return 1;
+    }
+    charset_converter_set_carry(conv, 1);
+
     while (1) {
 
 	rdret = fread(inbuf, 1, sizeof(inbuf), stdin);
@@ -46,27 +51,22 @@ int main(int argc, char **argv)
 
 	inlen = rdret;
 	inptr = inbuf;
-	while ( (inret = charset_to_unicode(&inptr, &inlen, midbuf,
-					    lenof(midbuf), srcset,
-					    &instate, NULL, 0)) > 0) {
-	    midlen = inret;
-	    midptr = midbuf;
-	    while ( (midret = charset_from_unicode(&midptr, &midlen, outbuf,
-						   lenof(outbuf), dstset,
-						   &outstate, NULL)) > 0) {
-		fwrite(outbuf, 1, midret, stdout);
-	    }
+	while ( (outret = charset_converter_convert(conv, &inptr, &inlen,
+						    outbuf, lenof(outbuf),
+						    NULL)) > 0) {
+	    fwrite(outbuf, 1, outret, stdout);
 	}
     }
 
     /*
      * Reset encoding state.
      */
-    while ( (midret = charset_from_unicode(NULL, NULL, outbuf,
-					   lenof(outbuf), dstset,
-					   &outstate, NULL)) > 0) {
-	fwrite(outbuf, 1, midret, stdout);
+    while ( (outret = charset_converter_convert(conv, NULL, NULL, outbuf,
+						lenof(outbuf), NULL)) > 0) {
+	fwrite(outbuf, 1, outret, stdout);
     }
 
+    charset_converter_free(conv);
+
     return 0;
 }
@@ -2,24 +2,54 @@
  * toucs.c - convert charsets to Unicode.
  */
 
+#include <string.h>
+
 #include "charset.h"
 #include "internal.h"
 
 struct unicode_emit_param {
     wchar_t *output;
-    int outlen;
-    int writtenlen;
+    size_t outlen;
+    size_t writtenlen;
     const wchar_t *errstr;
-    int errlen;
+    size_t errlen;
     int stopped;
+    struct unicode_carry *carry;
+    int nemitted;		       /* calls to emit for this input byte */
+    unsigned long errmask;	       /* which of those were errors */
+    /*
+     * The CRs and LFs among those, if someone wants to know: their
+     * characters, where they went in the output, and which call to
+     * emit produced them.
+     */
+    int wantends, nends;
+    struct {
+	wchar_t c;
+	size_t outpos;
+	int emitted;
+    } ends[4];
 };
 
+/*
+ * An emit function which throws its output away, for running a read
+ * function only for the state it leaves behind.
+ */
+void null_emit(void *ctx, long int output)
+{
+    UNUSEDARG(ctx);
+    UNUSEDARG(output);
+}
+
 static void unicode_emit(void *ctx, long int output)
 {
     struct unicode_emit_param *param = (struct unicode_emit_param *)ctx;
     wchar_t outval;
     wchar_t const *p;
-    int outlen;
+    size_t outlen;
+
+    if (output == ERROR && param->nemitted < 32)
+	param->errmask |= 1UL << param->nemitted;
+    param->nemitted++;
 
     if (output == ERROR) {
 	if (param->errstr) {
@@ -34,30 +64,194 @@ static void unicode_emit(void *ctx, long int output)
 	outval = output;
 	p = &outval;
 	outlen = 1;
+	if ((output == '\r' || output == '\n') && param->wantends &&
+	    param->nends < (int)lenof(param->ends)) {
+	    param->ends[param->nends].c = outval;
+	    param->ends[param->nends].outpos = param->writtenlen;
+	    param->ends[param->nends].emitted = param->nemitted - 1;
+	    param->nends++;
+	}
     }
 
-    if (param->outlen < 0 || param->outlen >= outlen) {
+    if (param->outlen == CHARSET_UNBOUNDED || param->outlen >= outlen) {
 	while (outlen > 0) {
 	    if (param->output)
 		*param->output++ = *p++;
-	    if (param->outlen > 0)
+	    if (param->outlen != CHARSET_UNBOUNDED)
 		param->outlen--;
 	    outlen--;
 	    param->writtenlen++;
 	}
+    } else if (param->carry && param->outlen + CARRYLEN -
+	       param->carry->len >= outlen) {
+	/*
+	 * Fill up the output buffer, and put the rest in the carry
+	 * buffer.
+	 */
+	while (outlen > 0) {
+	    if (param->outlen > 0) {
+		if (param->output)
+		    *param->output++ = *p;
+		param->outlen--;
+		param->writtenlen++;
+	    } else {
+		param->carry->buf[param->carry->len++] = *p;
+	    }
+	    p++;
+	    outlen--;
+	}
     } else {
 	param->stopped = 1;
     }
 }
 
-int charset_to_unicode(const char **input, int *inlen,
-		       wchar_t *output, int outlen,
-		       int charset, charset_state *state,
-		       const wchar_t *errstr, int errlen)
+/*
+ * Work out which input bytes produced the `i'th of the `k' outputs
+ * `read' emitted in response to the byte at offset `pos'. `start'
+ * is where the character we were part-way through began, and
+ * `partial' tells us whether the decoder is still part-way through
+ * one.
+ * 
+ * We assume that anything emitted before the last output (or
+ * anything at all, if the decoder is left mid-character) was for
+ * the sequence preceding this byte, which this byte has cut short;
+ * and that the last output, when the decoder is left at a
+ * character boundary, is for the sequence this byte completed.
+ */
+void output_source(size_t start, size_t pos, int partial, int i, int k,
+		   size_t *offset, size_t *length)
+{
+    if (partial || i < k-1) {
+	if (start < pos) {
+	    *offset = start;
+	    *length = pos - start;
+	} else {
+	    *offset = pos;
+	    *length = 1;
+	}
+    } else if (k == 1) {
+	*offset = start;
+	*length = pos + 1 - start;
+    } else {
+	*offset = pos;
+	*length = 1;
+    }
+}
+
+/*
+ * Report the errors among the outputs `read' emitted in response
+ * to the byte at offset `pos'.
+ */
+static void report_errors(struct unicode_emit_param *param,
+			  size_t start, size_t pos, int partial,
+			  void (*errfn)(void *ctx, size_t offset,
+					size_t length), void *errctx)
+{
+    int i, k = param->nemitted;
+    size_t offset, length;
+
+    for (i = 0; i < k && i < 32; i++) {
+	if (!(param->errmask & (1UL << i)))
+	    continue;
+	output_source(start, pos, partial, i, k, &offset, &length);
+	errfn(errctx, offset, length);
+    }
+}
+
+/*
+ * Report the CRs and LFs among the outputs `read' emitted in
+ * response to the byte at offset `pos'. Returns TRUE if `eolfn'
+ * asks us to stop.
+ */
+static int report_eols(struct unicode_emit_param *param,
+		       size_t start, size_t pos, int partial,
+		       charset_state const *state,
+		       int (*eolfn)(void *ctx, wchar_t c, size_t outpos,
+				    size_t offset, size_t inend,
+				    charset_state const *state),
+		       void *eolctx)
+{
+    int i, stop = FALSE;
+    size_t offset, length;
+
+    for (i = 0; i < param->nends; i++) {
+	output_source(start, pos, partial, param->ends[i].emitted,
+		      param->nemitted, &offset, &length);
+	if (eolfn(eolctx, param->ends[i].c, param->ends[i].outpos,
+		  offset, pos + 1, state))
+	    stop = TRUE;
+    }
+    return stop;
+}
+
+/*
+ * In a charset where ASCII bytes always mean ASCII, CR and LF can
+ * only come from CR and LF bytes; so everything up to the next one
+ * can be decoded in bulk even when line endings are wanted.
+ */
+static size_t span_to_eol(const unsigned char *p, size_t len)
+{
+    const unsigned char *lf = (const unsigned char *)memchr(p, '\n', len);
+    const unsigned char *cr;
+
+    if (lf)
+	len = lf - p;
+    cr = (const unsigned char *)memchr(p, '\r', len);
+    return cr ? (size_t)(cr - p) : len;
+}
+
+/*
+ * Find out whether ASCII currently stands for itself in the input,
+ * and if so, which ASCII bytes are exceptions. (See the description
+ * of `ascii_stops' in charset_spec.)
+ */
+const char *current_ascii_stops(charset_spec const *spec,
+				charset_state const *state)
+{
+    if (spec->ascii_stops)
+	return spec->ascii_stops(spec, state);
+    if ((spec->flags & CSF_ASCII) &&
+	!(spec->midchar && spec->midchar(spec, state)))
+	return "";
+    return NULL;
+}
+
+/*
+ * The guts of charset_to_unicode_errors(), with two optional extras.
+ * `eolfn' is called for each CR and LF decoded, with the output
+ * position it went to, the offset of the input sequence it came
+ * from (as for `errfn'), the offset just after the byte which
+ * produced it, and the state after that byte; if it returns TRUE,
+ * we stop after that byte. `carry' is as described in internal.h.
+ */
+size_t spec_to_unicode(charset_spec const *spec,
+		       const char **input, size_t *inlen,
+		       wchar_t *output, size_t outlen,
+		       charset_state *state,
+		       const wchar_t *errstr, size_t errlen,
+		       void (*errfn)(void *ctx, size_t offset, size_t length),
+		       void *errctx,
+		       int (*eolfn)(void *ctx, wchar_t c, size_t outpos,
+				    size_t offset, size_t inend,
+				    charset_state const *state),
+		       void *eolctx, struct unicode_carry *carry)
 {
-    charset_spec const *spec = charset_find_spec(charset);
     charset_state localstate = CHARSET_INIT_STATE;
     struct unicode_emit_param param;
+    const char *base = *input;
+    size_t start = 0;
+    int stop = FALSE;
+
+    if (!output && outlen == CHARSET_UNBOUNDED && !errfn && !eolfn) {
+	/*
+	 * A dry run with no limit is just a measurement.
+	 */
+	size_t ret = spec_measure_to_unicode(spec, *input, *inlen, state,
+					     errstr, errlen);
+	*input += *inlen;
+	*inlen = 0;
+	return ret;
+    }
 
     param.output = output;
     param.outlen = outlen;
@@ -65,12 +259,84 @@ int charset_to_unicode(const char **input, int *inlen,
     param.errlen = errlen;
     param.writtenlen = 0;
     param.stopped = 0;
+    param.carry = carry;
+    param.wantends = (eolfn != NULL);
 
     if (state)
 	localstate = *state;	       /* structure copy */
 
     while (*inlen > 0) {
-	int lenbefore = param.writtenlen;
+	size_t lenbefore;
+
+	if (spec->read_block && (!eolfn || (spec->flags & CSF_ASCII))) {
+	    /*
+	     * Let the block reader handle as much as it can (only up
+	     * to the next CR or LF, if we're reporting those). In a
+	     * dry run we give it a scratch buffer to write into, and
+	     * keep calling it for as long as it's getting anywhere.
+	     */
+	    wchar_t scratch[256];
+	    size_t n = (eolfn ? span_to_eol((const unsigned char *)*input,
+					    *inlen) : *inlen);
+	    size_t left = n, ret;
+
+	    do {
+		if (param.output)
+		    ret = spec->read_block(spec, input, &left, &localstate,
+					   param.output, param.outlen);
+		else
+		    ret = spec->read_block(spec, input, &left, &localstate,
+					   scratch, (param.outlen < lenof(scratch) ?
+						     param.outlen :
+						     lenof(scratch)));
+		if (param.output)
+		    param.output += ret;
+		if (param.outlen != CHARSET_UNBOUNDED)
+		    param.outlen -= ret;
+		param.writtenlen += ret;
+	    } while (!param.output && ret > 0 && left > 0);
+	    *inlen -= n - left;
+
+	    if (state)
+		*state = localstate;   /* structure copy */
+	    if (!(spec->midchar && spec->midchar(spec, &localstate)))
+		start = *input - base;
+	    if (*inlen == 0)
+		break;
+	}
+
+	if ((unsigned char)**input < 0x80) {
+	    /*
+	     * If ASCII currently stands for itself, copy as much of
+	     * it as we can straight to the output.
+	     */
+	    const char *stops = current_ascii_stops(spec, &localstate);
+
+	    if (stops) {
+		const unsigned char *p = (const unsigned char *)*input;
+		size_t n = (*inlen < param.outlen ? *inlen : param.outlen);
+
+		if (eolfn)
+		    n = span_to_eol(p, n);
+		n = ascii_span_except(p, n, stops);
+		if (n > 0) {
+		    if (param.output)
+			param.output += ascii_widen(&p, n, param.output, n);
+		    if (param.outlen != CHARSET_UNBOUNDED)
+			param.outlen -= n;
+		    param.writtenlen += n;
+		    *input += n;
+		    *inlen -= n;
+		    start = *input - base;
+		    continue;
+		}
+	    }
+	}
+
+	lenbefore = param.writtenlen;
+	param.nemitted = 0;
+	param.errmask = 0;
+	param.nends = 0;
 	spec->read(spec, (unsigned char)**input, &localstate,
 		   unicode_emit, &param);
 	if (param.stopped) {
@@ -80,13 +346,168 @@ int charset_to_unicode(const char **input, int *inlen,
 	     * buffer. Leave immediately, and return what happened
 	     * _before_ attempting to process this character.
 	     */
+	    if (carry)
+		carry->len = 0;
 	    return lenbefore;
 	}
 	if (state)
 	    *state = localstate;   /* structure copy */
+	if (errfn || eolfn) {
+	    size_t pos = *input - base;
+	    int partial = spec->midchar && spec->midchar(spec, &localstate);
+
+	    if (param.errmask && errfn)
+		report_errors(&param, start, pos, partial, errfn, errctx);
+	    if (param.nends && report_eols(&param, start, pos, partial,
+					   &localstate, eolfn, eolctx))
+		stop = TRUE;
+	    if (!partial)
+		start = pos + 1;
+	    else if (param.nemitted > 0)
+		start = pos;
+	}
 	(*input)++;
 	(*inlen)--;
+	if (stop)
+	    break;		       /* eolfn asked us to */
+	if (carry && carry->len)
+	    break;		       /* output buffer is full */
     }
 
     return param.writtenlen;
 }
+
+/*
+ * Write some units if there's room for them all.
+ */
+void units_put(struct units_param *param, const void *p, size_t len)
+{
+    size_t size = param->writer->unitsize;
+
+    if (param->outlen != CHARSET_UNBOUNDED) {
+	if (param->outlen < len) {
+	    param->stopped = 1;
+	    return;
+	}
+	param->outlen -= len;
+    }
+    if (param->output) {
+	memcpy(param->output, p, len * size);
+	param->output = (char *)param->output + len * size;
+    }
+    param->writtenlen += len;
+}
+
+/*
+ * The guts of charset_to_utf8() and charset_to_utf16units(), which
+ * differ only in `writer'. `output', `outlen' and `errstr' are in
+ * the writer's units.
+ */
+size_t spec_to_units(charset_spec const *spec,
+		     const char **input, size_t *inlen,
+		     void *output, size_t outlen, charset_state *state,
+		     const void *errstr, size_t errlen,
+		     struct units_writer const *writer)
+{
+    charset_state localstate = CHARSET_INIT_STATE;
+    struct units_param param;
+
+    param.output = output;
+    param.outlen = outlen;
+    param.writtenlen = 0;
+    param.errstr = errstr;
+    param.errlen = errlen;
+    param.stopped = 0;
+    param.writer = writer;
+
+    if (state)
+	localstate = *state;	       /* structure copy */
+
+    while (*inlen > 0) {
+	const unsigned char *p = (const unsigned char *)*input;
+	size_t lenbefore;
+
+	if (writer->block) {
+	    writer->block(spec, input, inlen, &localstate, &param);
+	    if (param.stopped)
+		break;		       /* output buffer is full */
+	    if (*input != (const char *)p)
+		continue;
+	}
+
+	if (*p < 0x80) {
+	    /*
+	     * ASCII which currently stands for itself can be copied.
+	     */
+	    const char *stops = current_ascii_stops(spec, &localstate);
+	    size_t n = (*inlen < param.outlen ? *inlen : param.outlen);
+
+	    if (stops && (n = ascii_span_except(p, n, stops)) > 0) {
+		writer->ascii(&param, p, n);
+		*input += n;
+		*inlen -= n;
+		continue;
+	    }
+	}
+
+	lenbefore = param.writtenlen;
+	spec->read(spec, *p, &localstate, writer->emit, &param);
+	if (param.stopped) {
+	    /*
+	     * The output buffer is full. Return what happened before
+	     * this byte, as charset_to_unicode_sz() does.
+	     */
+	    return lenbefore;
+	}
+	if (state)
+	    *state = localstate;       /* structure copy */
+	(*input)++;
+	(*inlen)--;
+    }
+
+    if (state)
+	*state = localstate;	       /* structure copy */
+    return param.writtenlen;
+}
+
+size_t charset_to_unicode_sz(const char **input, size_t *inlen,
+			     wchar_t *output, size_t outlen,
+			     int charset, charset_state *state,
+			     const wchar_t *errstr, size_t errlen)
+{
+    return spec_to_unicode(charset_find_spec(charset), input, inlen,
+			   output, outlen, state, errstr, errlen,
+			   NULL, NULL, NULL, NULL, NULL);
+}
+
+size_t charset_to_unicode_errors(const char **input, size_t *inlen,
+				 wchar_t *output, size_t outlen,
+				 int charset, charset_state *state,
+				 const wchar_t *errstr, size_t errlen,
+				 void (*errfn)(void *ctx, size_t offset,
+					       size_t length),
+				 void *errctx)
+{
+    return spec_to_unicode(charset_find_spec(charset), input, inlen,
+			   output, outlen, state, errstr, errlen,
+			   errfn, errctx, NULL, NULL, NULL);
+}
+
+int charset_to_unicode(const char **input, int *inlen,
+		       wchar_t *output, int outlen,
+		       int charset, charset_state *state,
+		       const wchar_t *errstr, int errlen)
+{
+    size_t len, ret;
+
+    if (*inlen <= 0)
+	return 0;
+
+    len = *inlen;
+    ret = charset_to_unicode_sz(input, &len, output,
+				(outlen < 0 ? CHARSET_UNBOUNDED :
+				 (size_t)outlen), charset, state,
+				errstr, (errstr ? (size_t)errlen : 0));
+    *inlen = len;
+    return ret;
+}
@@ -4,6 +4,8 @@
 
 #ifndef ENUM_CHARSETS
 
+#include <string.h>
+
 #include "charset.h"
 #include "internal.h"
 
@@ -11,10 +13,9 @@ struct utf16 {
     int s0;			       /* initial value of state->s0 */
 };
 
-static void read_utf16(charset_spec const *charset, long int input_chr,
-		       charset_state *state,
-		       void (*emit)(void *ctx, long int output),
-		       void *emitctx)
+void read_utf16(charset_spec const *charset, long int input_chr,
+		charset_state *state,
+		void (*emit)(void *ctx, long int output), void *emitctx)
 {
     struct utf16 const *utf = (struct utf16 *)charset->data;
     long int hw;
@@ -136,6 +137,56 @@ static void read_utf16(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * read_utf16 is part-way through a character if it has half a
+ * halfword, or a high surrogate waiting for its partner.
+ */
+static int midchar_utf16(charset_spec const *charset,
+			 charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return state->s1 != 0 || (state->s0 & 0xFFFF) != 0;
+}
+
+/*
+ * Once we know where the halfwords begin and which way round they
+ * are, we can pick up UTF-16 after any halfword which isn't a high
+ * surrogate. We find those things out by running read_utf16 over
+ * the first halfword, which also deals with any BOM.
+ */
+static size_t sync_utf16(charset_spec const *charset,
+			 const unsigned char *input, size_t inlen, size_t pos,
+			 charset_state *state)
+{
+    charset_state first = *state;      /* structure copy */
+    size_t i, start = (state->s1 ? 1 : 2);
+
+    if (inlen < start)
+	return inlen;
+    for (i = 0; i < start; i++)
+	read_utf16(charset, input[i], &first, null_emit, NULL);
+    if (pos <= start) {
+	*state = first;		       /* structure copy */
+	return start;
+    }
+
+    for (pos += (pos - start) & 1; pos < inlen; pos += 2) {
+	unsigned hw;
+
+	if (first.s0 & 0x10000)
+	    hw = input[pos-2] | (input[pos-1] << 8);
+	else
+	    hw = (input[pos-2] << 8) | input[pos-1];
+	if (hw < 0xD800 || hw >= 0xDC00) {
+	    state->s0 = first.s0 & 0xFFFF0000;
+	    state->s1 = 0;
+	    return pos;
+	}
+    }
+    return inlen;
+}
+
 /*
  * Repeated code in write_utf16 abstracted out for sanity.
  */
@@ -194,18 +245,296 @@ static int write_utf16(charset_spec const *charset, long int input_chr,
     return TRUE;
 }
 
+/*
+ * Block versions of read_utf16 and write_utf16. These only come
+ * into play once the byte order has been settled (and, on output,
+ * once the BOM has been written), and they deal only with
+ * complete, correctly paired halfwords.
+ */
+static size_t read_utf16_block(charset_spec const *charset,
+			       const char **input, size_t *inlen,
+			       charset_state *state, wchar_t *output,
+			       size_t outlen)
+{
+    const unsigned char *p = (const unsigned char *)*input;
+    const unsigned char *end = p + *inlen;
+    size_t i;
+    int hi, lo;
+    long int hw, hw2;
+
+    UNUSEDARG(charset);
+
+    /*
+     * We need to be between halfwords, with no high surrogate
+     * pending, and to have seen at least one halfword so that the
+     * endianness bits are definite.
+     */
+    if (state->s1 != 0 || !(state->s0 & 0x40000) || (state->s0 & 0xFFFF))
+	return 0;
+
+    if (state->s0 & 0x10000)
+	hi = 1, lo = 0;		       /* little-endian */
+    else
+	hi = 0, lo = 1;		       /* big-endian */
+
+    for (i = 0; i < outlen && end - p >= 2; i++) {
+	hw = (p[hi] << 8) | p[lo];
+	if ((hw >= 0xDC00 && hw < 0xE000) || hw == ERROR)
+	    break;		       /* stray low surrogate, or U+FFFF */
+	if (hw >= 0xD800 && hw < 0xDC00) {
+	    if (end - p < 4)
+		break;		       /* incomplete pair */
+	    hw2 = (p[2+hi] << 8) | p[2+lo];
+	    if (hw2 < 0xDC00 || hw2 >= 0xE000)
+		break;		       /* unpaired high surrogate */
+	    output[i] = (((hw & 0x3FF) << 10) | (hw2 & 0x3FF)) + 0x10000;
+	    p += 4;
+	} else {
+	    output[i] = hw;
+	    p += 2;
+	}
+    }
+
+    *inlen -= p - (const unsigned char *)*input;
+    *input = (const char *)p;
+    return i;
+}
+
+/*
+ * Return TRUE if read_utf16 will take `input', read from the
+ * initial state, to be big-endian: either because the charset says
+ * so, or because it could be either and `input' doesn't start with
+ * a little-endian BOM.
+ */
+int utf16_input_bigendian(charset_spec const *charset,
+			  const unsigned char *input, size_t inlen)
+{
+    struct utf16 const *utf = (struct utf16 *)charset->data;
+
+    if (!(utf->s0 & 0x10000))
+	return TRUE;
+    if (!(utf->s0 & 0x20000))
+	return FALSE;
+    return !(inlen >= 2 && input[0] == 0xFF && input[1] == 0xFE);
+}
+
+/*
+ * Like read_utf16_block, but for charset_to_utf16units(): the
+ * halfwords are copied out as they are, a surrogate pair being
+ * copied whole or not at all. Runs without surrogates are found
+ * with utf16_plain_span() and copied in bulk, with memcpy if they
+ * are already in the host's byte order. `output' may be NULL to
+ * just count.
+ */
+size_t read_utf16_units(charset_spec const *charset,
+			const char **input, size_t *inlen,
+			charset_state *state, charset_char16 *output,
+			size_t outlen)
+{
+    static const charset_char16 one = 1;
+    const unsigned char *p = (const unsigned char *)*input;
+    const unsigned char *end = p + *inlen;
+    size_t i = 0, j, n;
+    int hi, lo, bigendian, native;
+    long int hw, hw2;
+
+    UNUSEDARG(charset);
+
+    if (state->s1 != 0 || !(state->s0 & 0x40000) || (state->s0 & 0xFFFF))
+	return 0;
+
+    bigendian = !(state->s0 & 0x10000);
+    if (bigendian)
+	hi = 0, lo = 1;
+    else
+	hi = 1, lo = 0;
+    native = (sizeof(charset_char16) == 2 &&
+	      *(const unsigned char *)&one == hi);
+
+    while (i < outlen && end - p >= 2) {
+	n = (size_t)(end - p) / 2;
+	if (n > outlen - i)
+	    n = outlen - i;
+	n = utf16_plain_span(p, 2 * n, bigendian) / 2;
+	if (output) {
+	    if (native)
+		memcpy(output + i, p, 2 * n);
+	    else
+		for (j = 0; j < n; j++)
+		    output[i+j] = (charset_char16)((p[2*j+hi] << 8) |
+						   p[2*j+lo]);
+	}
+	i += n;
+	p += 2 * n;
+	if (i == outlen || end - p < 2)
+	    break;
+
+	/*
+	 * We've stopped at a surrogate or U+FFFF, and can only go on
+	 * if it's a high surrogate with its partner after it and
+	 * there's room for both.
+	 */
+	hw = (p[hi] << 8) | p[lo];
+	if (hw >= 0xDC00 || end - p < 4 || outlen - i < 2)
+	    break;
+	hw2 = (p[2+hi] << 8) | p[2+lo];
+	if (hw2 < 0xDC00 || hw2 >= 0xE000)
+	    break;		       /* unpaired high surrogate */
+	if (output) {
+	    output[i] = (charset_char16)hw;
+	    output[i+1] = (charset_char16)hw2;
+	}
+	i += 2;
+	p += 4;
+    }
+
+    *inlen -= p - (const unsigned char *)*input;
+    *input = (const char *)p;
+    return i;
+}
+
+static size_t write_utf16_block(charset_spec const *charset,
+				const wchar_t **input, size_t *inlen,
+				charset_state *state, char *output,
+				size_t outlen)
+{
+    struct utf16 const *utf = (struct utf16 *)charset->data;
+    const wchar_t *p = *input, *end = p + *inlen;
+    size_t o = 0;
+    int hi, lo;
+
+    /*
+     * Let write_utf16 output the BOM.
+     */
+    if (!state->s0)
+	return 0;
+
+    if (utf->s0 & 0x20000)
+	hi = 0, lo = 1;		       /* big-endian, as in emithl */
+    else
+	hi = 1, lo = 0;
+
+    while (p < end) {
+	long int c = *p;
+
+	if (c < 0 || (c >= 0xD800 && c < 0xE000) || c >= 0x110000)
+	    break;
+
+	if (c < 0x10000) {
+	    if (outlen - o < 2) break;
+	    output[o+hi] = (c >> 8) & 0xFF;
+	    output[o+lo] = c & 0xFF;
+	    o += 2;
+	} else {
+	    long int h, l;
+	    if (outlen - o < 4) break;
+	    c -= 0x10000;
+	    h = 0xD800 | ((c >> 10) & 0x3FF);
+	    l = 0xDC00 | (c & 0x3FF);
+	    output[o+hi] = (h >> 8) & 0xFF;
+	    output[o+lo] = h & 0xFF;
+	    output[o+2+hi] = (l >> 8) & 0xFF;
+	    output[o+2+lo] = l & 0xFF;
+	    o += 4;
+	}
+	p++;
+    }
+
+    *inlen -= p - *input;
+    *input = p;
+    return o;
+}
+
+/*
+ * Counting versions of read_utf16 and write_utf16. Once the byte
+ * order is settled, every halfword produces one output character,
+ * except that a high surrogate always swallows the halfword after
+ * it (whether or not it's a valid low surrogate).
+ */
+static size_t read_utf16_count(charset_spec const *charset,
+			       const char **input, size_t *inlen,
+			       charset_state *state, size_t errlen)
+{
+    const unsigned char *p = (const unsigned char *)*input;
+    const unsigned char *end = p + *inlen;
+    size_t count = 0;
+    int hi;
+
+    UNUSEDARG(charset);
+
+    if (errlen != 1 || state->s1 != 0 || !(state->s0 & 0x40000) ||
+	(state->s0 & 0xFFFF))
+	return 0;
+
+    hi = (state->s0 & 0x10000 ? 1 : 0);
+
+    while (end - p >= 2) {
+	if ((p[hi] & 0xFC) == 0xD8) {
+	    if (end - p < 4)
+		break;		       /* leave the high surrogate pending */
+	    p += 4;
+	} else {
+	    p += 2;
+	}
+	count++;
+    }
+
+    *inlen -= p - (const unsigned char *)*input;
+    *input = (const char *)p;
+    return count;
+}
+
+static size_t write_utf16_count(charset_spec const *charset,
+				const wchar_t **input, size_t *inlen,
+				charset_state *state)
+{
+    const wchar_t *p = *input, *end = p + *inlen;
+    size_t count = 0;
+
+    UNUSEDARG(charset);
+
+    /*
+     * Let write_utf16 count the BOM.
+     */
+    if (!state->s0)
+	return 0;
+
+    for (; p < end; p++) {
+	long int c = *p;
+
+	if (c < 0)
+	    break;
+	if ((c >= 0xD800 && c < 0xE000) || c >= 0x110000)
+	    continue;		       /* write_utf16 refuses these */
+	count += (c < 0x10000 ? 2 : 4);
+    }
+
+    *inlen -= p - *input;
+    *input = p;
+    return count;
+}
+
 static const struct utf16 utf16_bigendian = { 0x20000 };
 static const struct utf16 utf16_littleendian = { 0x10000 };
 static const struct utf16 utf16_variable_endianness = { 0x30000 };
 
 const charset_spec charset_CS_UTF16BE = {
-    CS_UTF16BE, read_utf16, write_utf16, &utf16_bigendian
+    CS_UTF16BE, read_utf16, write_utf16, &utf16_bigendian,
+    read_utf16_block, write_utf16_block,
+    read_utf16_count, write_utf16_count, midchar_utf16, NULL, sync_utf16,
+    6, 0, 1, CSF_SELFSYNC
 };
 const charset_spec charset_CS_UTF16LE = {
-    CS_UTF16LE, read_utf16, write_utf16, &utf16_littleendian
+    CS_UTF16LE, read_utf16, write_utf16, &utf16_littleendian,
+    read_utf16_block, write_utf16_block,
+    read_utf16_count, write_utf16_count, midchar_utf16, NULL, sync_utf16,
+    6, 0, 1, CSF_SELFSYNC
 };
 const charset_spec charset_CS_UTF16 = {
-    CS_UTF16, read_utf16, write_utf16, &utf16_variable_endianness
+    CS_UTF16, read_utf16, write_utf16, &utf16_variable_endianness,
+    read_utf16_block, write_utf16_block,
+    read_utf16_count, write_utf16_count, midchar_utf16, NULL, sync_utf16,
+    6, 0, 1, CSF_SELFSYNC
 };
 
 #else /* ENUM_CHARSETS */
@@ -0,0 +1,538 @@
+/*
+ * utf16units.c - convert between any charset and UTF-16 code units
+ * in memory, whatever the size of wchar_t.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+static void units_emit(void *ctx, long int output)
+{
+    static const charset_char16 replacement = 0xFFFD;
+    struct units_param *param = (struct units_param *)ctx;
+    charset_char16 buf[2];
+
+    if (param->stopped)
+	return;
+    if (output == ERROR || output < 0 || output >= 0x110000 ||
+	(output >= 0xD800 && output < 0xE000)) {
+	if (param->errstr)
+	    units_put(param, param->errstr, param->errlen);
+	else
+	    units_put(param, &replacement, 1);
+    } else if (output < 0x10000) {
+	buf[0] = (charset_char16)output;
+	units_put(param, buf, 1);
+    } else {
+	output -= 0x10000;
+	buf[0] = (charset_char16)(0xD800 | (output >> 10));
+	buf[1] = (charset_char16)(0xDC00 | (output & 0x3FF));
+	units_put(param, buf, 2);
+    }
+}
+
+/*
+ * Widen ASCII into code units, there being room for them.
+ */
+static void units_ascii(struct units_param *param, const unsigned char *p,
+			size_t n)
+{
+    charset_char16 *out = (charset_char16 *)param->output;
+    size_t i;
+
+    if (out) {
+	for (i = 0; i < n; i++)
+	    out[i] = p[i];
+	param->output = out + n;
+    }
+    if (param->outlen != CHARSET_UNBOUNDED)
+	param->outlen -= n;
+    param->writtenlen += n;
+}
+
+static void units_block(charset_spec const *spec,
+			const char **input, size_t *inlen,
+			charset_state *state, struct units_param *param)
+{
+    charset_char16 *out = (charset_char16 *)param->output;
+    size_t n;
+
+    if (spec->read == read_utf16) {
+	n = read_utf16_units(spec, input, inlen, state, out, param->outlen);
+	if (out)
+	    param->output = out + n;
+	if (param->outlen != CHARSET_UNBOUNDED)
+	    param->outlen -= n;
+	param->writtenlen += n;
+    } else if (spec->read == read_sbcs) {
+	/*
+	 * Every character of a single-byte charset is in the BMP,
+	 * so we can look them up and write them out directly.
+	 * Undefined bytes go through the decoder to be reported.
+	 */
+	const struct sbcs_data *sd = (const struct sbcs_data *)spec->data;
+	const unsigned char *p = (const unsigned char *)*input;
+	size_t i;
+
+	n = (*inlen < param->outlen ? *inlen : param->outlen);
+	for (i = 0; i < n && sd->sbcs2ucs[p[i]] != ERROR; i++)
+	    if (out)
+		*out++ = (charset_char16)sd->sbcs2ucs[p[i]];
+	if (out)
+	    param->output = out;
+	if (param->outlen != CHARSET_UNBOUNDED)
+	    param->outlen -= i;
+	param->writtenlen += i;
+	*input += i;
+	*inlen -= i;
+    }
+}
+
+static const struct units_writer units_writer = {
+    sizeof(charset_char16), units_emit, units_ascii, units_block
+};
+
+size_t charset_to_utf16units(const char **input, size_t *inlen,
+			     charset_char16 *output, size_t outlen,
+			     int charset, charset_state *state,
+			     const charset_char16 *errstr, size_t errlen)
+{
+    return spec_to_units(charset_find_spec(charset), input, inlen,
+			 output, outlen, state, errstr, errlen,
+			 &units_writer);
+}
+
+struct bytes_param {
+    char *output;
+    size_t outlen;
+    size_t writtenlen;
+    int stopped;
+};
+
+static void bytes_emit(void *ctx, long int output)
+{
+    struct bytes_param *param = (struct bytes_param *)ctx;
+
+    if (param->outlen == 0) {
+	param->stopped = 1;
+	return;
+    }
+    if (param->output)
+	*param->output++ = (char)output;
+    if (param->outlen != CHARSET_UNBOUNDED)
+	param->outlen--;
+    param->writtenlen++;
+}
+
+size_t charset_from_utf16units(const charset_char16 **input, size_t *inlen,
+			       char *output, size_t outlen,
+			       int charset, charset_state *state,
+			       int *error)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state localstate = CHARSET_INIT_STATE;
+    size_t writtenlen = 0;
+
+    if (!input)
+	return spec_from_unicode(spec, NULL, NULL, output, outlen,
+				 state, error, NULL);
+
+    if (error)
+	*error = FALSE;
+
+    if (state)
+	localstate = *state;	       /* structure copy */
+
+    while (*inlen > 0) {
+	const charset_char16 *p = *input;
+	struct bytes_param param;
+	charset_state trystate;
+	long int c;
+	size_t units;
+
+	if (p[0] < 0xD800 || p[0] >= 0xE000) {
+	    /*
+	     * A run of BMP characters means the same in any wchar_t,
+	     * so it can go through spec_from_unicode() in blocks.
+	     */
+	    wchar_t buf[256];
+	    const wchar_t *q = buf;
+	    size_t n, left, ret;
+
+	    for (n = 0; n < *inlen && n < lenof(buf) &&
+		     (p[n] < 0xD800 || p[n] >= 0xE000); n++)
+		buf[n] = p[n];
+	    left = n;
+	    ret = spec_from_unicode(spec, &q, &left, output, outlen,
+				    &localstate, error, NULL);
+	    if (output)
+		output += ret;
+	    if (outlen != CHARSET_UNBOUNDED)
+		outlen -= ret;
+	    writtenlen += ret;
+	    *input += n - left;
+	    *inlen -= n - left;
+	    if (left > 0)
+		break;		       /* error, or output buffer full */
+	    continue;
+	}
+
+	/*
+	 * Otherwise we have a surrogate, which we combine with its
+	 * partner if it has one and hand straight to the encoder.
+	 */
+	c = p[0];
+	units = 1;
+	if (c < 0xDC00) {
+	    if (*inlen < 2)
+		break;		       /* the rest may be in the next call */
+	    if (p[1] >= 0xDC00 && p[1] < 0xE000) {
+		c = (((c & 0x3FF) << 10) | (p[1] & 0x3FF)) + 0x10000;
+		units = 2;
+	    }
+	}
+
+	trystate = localstate;	       /* structure copy */
+	param.output = output;
+	param.outlen = outlen;
+	param.writtenlen = 0;
+	param.stopped = 0;
+	if (!spec->write(spec, c, &trystate, bytes_emit, &param) && error) {
+	    *error = TRUE;
+	    break;
+	}
+	if (param.stopped)
+	    break;		       /* output buffer is full */
+	localstate = trystate;	       /* structure copy */
+	output = param.output;
+	outlen = param.outlen;
+	writtenlen += param.writtenlen;
+	*input += units;
+	*inlen -= units;
+    }
+
+    if (state)
+	*state = localstate;	       /* structure copy */
+    return writtenlen;
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <string.h>
+
+int total_errs = 0;
+
+/*
+ * Decode `input' with charset_to_unicode_sz(), with U+FFFF standing
+ * in for errors, and write the result as code units by hand, errors
+ * becoming `errstr' or U+FFFD and characters outside the BMP
+ * becoming surrogate pairs.
+ */
+size_t reference_units(int charset, const char *input, size_t inlen,
+		       const charset_char16 *errstr, size_t errlen,
+		       charset_char16 *out)
+{
+    wchar_t wbuf[1024];
+    charset_state state = CHARSET_INIT_STATE;
+    size_t i, n, len = 0;
+
+    n = charset_to_unicode_sz(&input, &inlen, wbuf, lenof(wbuf), charset,
+			      &state, L"\xFFFF", 1);
+    for (i = 0; i < n; i++) {
+	unsigned long c = wbuf[i];
+
+	if (c == 0xFFFF) {
+	    if (errstr) {
+		memcpy(out + len, errstr, errlen * sizeof(*errstr));
+		len += errlen;
+		continue;
+	    }
+	    c = 0xFFFD;
+	}
+	if (c >= 0x10000) {
+	    c -= 0x10000;
+	    out[len++] = (charset_char16)(0xD800 | (c >> 10));
+	    out[len++] = (charset_char16)(0xDC00 | (c & 0x3FF));
+	} else {
+	    out[len++] = (charset_char16)c;
+	}
+    }
+    return len;
+}
+
+/*
+ * Decode `input' with charset_to_utf16units(), in two pieces split
+ * at every point in turn, and then in one piece into output buffers
+ * of every size from 2 units up (carrying on with a fresh buffer
+ * each time one fills), and check it all against reference_units().
+ */
+void to_units_test(int line, int charset, const char *input, size_t inlen,
+		   const charset_char16 *errstr, size_t errlen)
+{
+    charset_char16 expected[1024], output[1024];
+    size_t explen, split, outlen;
+
+    explen = reference_units(charset, input, inlen, errstr, errlen,
+			     expected);
+
+    for (split = 0; split <= inlen; split++) {
+	charset_state state = CHARSET_INIT_STATE;
+	const char *p = input;
+	size_t left = split, len;
+
+	len = charset_to_utf16units(&p, &left, output, lenof(output),
+				    charset, &state, errstr, errlen);
+	left = inlen - split;
+	len += charset_to_utf16units(&p, &left, output + len,
+				     lenof(output) - len, charset, &state,
+				     errstr, errlen);
+	if (len != explen ||
+	    memcmp(output, expected, len * sizeof(*output))) {
+	    printf("%d: split at %d: output differs\n", line, (int)split);
+	    total_errs++;
+	    return;
+	}
+    }
+
+    for (outlen = 2; outlen <= explen + 1; outlen++) {
+	charset_state state = CHARSET_INIT_STATE;
+	const char *p = input;
+	size_t left = inlen, len = 0, ret;
+
+	do {
+	    ret = charset_to_utf16units(&p, &left, output + len, outlen,
+					charset, &state, errstr, errlen);
+	    if (ret > outlen) {
+		printf("%d: outlen %d: wrote %d units\n",
+		       line, (int)outlen, (int)ret);
+		total_errs++;
+		return;
+	    }
+	    len += ret;
+	} while (left > 0 && ret > 0);
+	if (left > 0 || len != explen ||
+	    memcmp(output, expected, len * sizeof(*output))) {
+	    printf("%d: outlen %d: output differs\n", line, (int)outlen);
+	    total_errs++;
+	    return;
+	}
+    }
+
+    {
+	const char *p = input;
+	size_t left = inlen;
+
+	if (charset_to_utf16units(&p, &left, NULL, CHARSET_UNBOUNDED,
+				  charset, NULL, errstr, errlen) != explen ||
+	    left != 0) {
+	    printf("%d: dry run gave the wrong length\n", line);
+	    total_errs++;
+	}
+    }
+}
+
+#define TO_UNITS(charset, input) \
+    to_units_test(__LINE__, charset, input, sizeof(input)-1, NULL, 0)
+
+/*
+ * Decode `input' into `outlen' units in one call, and check how
+ * many units it returns and how much input it leaves.
+ */
+void stop_test(int line, int charset, const char *input, size_t inlen,
+	       size_t outlen, size_t expret, size_t expleft)
+{
+    charset_char16 output[64];
+    charset_state state = CHARSET_INIT_STATE;
+    const char *p = input;
+    size_t left = inlen, ret;
+
+    ret = charset_to_utf16units(&p, &left, output, outlen, charset,
+				&state, NULL, 0);
+    if (ret != expret || left != expleft) {
+	printf("%d: returned %d with %d left, expected %d with %d left\n",
+	       line, (int)ret, (int)left, (int)expret, (int)expleft);
+	total_errs++;
+    }
+}
+
+#define STOP(charset, input, outlen, expret, expleft) \
+    stop_test(__LINE__, charset, input, sizeof(input)-1, outlen, \
+	      expret, expleft)
+
+/*
+ * Encode `input' with charset_from_utf16units() and with
+ * charset_from_unicode_sz(), into a buffer of `outlen' bytes, with
+ * and without a state and an error flag, and check that the two
+ * agree on everything. For the latter, surrogate pairs are
+ * combined into single wchar_t.
+ */
+void from_units_test(int line, int charset, const charset_char16 *input,
+		     int inlen, int outlen)
+{
+    wchar_t winput[1024];
+    int unitpos[1025];
+    char out1[4096], out2[4096];
+    int i, n, usestate, useerror;
+
+    for (i = n = 0; i < inlen; n++) {
+	unitpos[n] = i;
+	if (i+1 < inlen && input[i] >= 0xD800 && input[i] < 0xDC00 &&
+	    input[i+1] >= 0xDC00 && input[i+1] < 0xE000) {
+	    winput[n] = (((input[i] & 0x3FF) << 10) |
+			 (input[i+1] & 0x3FF)) + 0x10000;
+	    i += 2;
+	} else {
+	    winput[n] = input[i++];
+	}
+    }
+    unitpos[n] = inlen;
+
+    for (usestate = 0; usestate < 2; usestate++) {
+	for (useerror = 0; useerror < 2; useerror++) {
+	    charset_state st1 = CHARSET_INIT_STATE;
+	    charset_state st2 = CHARSET_INIT_STATE;
+	    const charset_char16 *p = input;
+	    const wchar_t *q = winput;
+	    size_t left1 = inlen, left2 = n, ret1, ret2;
+	    int err1 = FALSE, err2 = FALSE;
+
+	    ret1 = charset_from_utf16units(&p, &left1, out1, outlen, charset,
+					   usestate ? &st1 : NULL,
+					   useerror ? &err1 : NULL);
+	    ret2 = charset_from_unicode_sz(&q, &left2, out2, outlen, charset,
+					   usestate ? &st2 : NULL,
+					   useerror ? &err2 : NULL);
+	    left2 = inlen - unitpos[n - left2];
+	    if (ret1 != ret2 || memcmp(out1, out2, ret1)) {
+		printf("%d: (%d,%d) output differs\n",
+		       line, usestate, useerror);
+		total_errs++;
+	    }
+	    if (left1 != left2 || err1 != err2) {
+		printf("%d: (%d,%d) stopped with %d left, error %d; "
+		       "should be %d left, error %d\n", line,
+		       usestate, useerror, (int)left1, err1, (int)left2, err2);
+		total_errs++;
+	    }
+	    if (memcmp(&st1, &st2, sizeof(st1))) {
+		printf("%d: (%d,%d) final state differs\n",
+		       line, usestate, useerror);
+		total_errs++;
+	    }
+	}
+    }
+}
+
+int main(void)
+{
+    static const int charsets[] = {
+	CS_ISO2022_JP, CS_ISO2022_KR, CS_HZ, CS_UTF7, CS_UTF8, CS_EUC_JP,
+    };
+    static const charset_char16 errstr[] = { '<', '>' };
+    charset_char16 buf[600];
+    char bytes[600];
+    int i, j;
+
+    printf("to_units tests beginning\n");
+
+    /*
+     * UTF-16 itself, which mostly goes through read_utf16_units: runs
+     * long enough for the vector kernels, surrogate pairs, stray
+     * surrogates, U+FFFF and an odd byte at the end.
+     */
+    TO_UNITS(CS_UTF16BE, "\0a\0b\0c\0d\0e\0f\0g\0h\0i\0j\0k\0l\0m\0n"
+	     "\x30\x42\xD8\x3D\xDE\x00\0z\xDE\x00\0y\xD8\x3D\0x"
+	     "\xFF\xFF\0w\xD8\x3D");
+    TO_UNITS(CS_UTF16LE, "a\0b\0c\0d\0e\0f\0g\0h\0i\0j\0k\0l\0m\0n\0"
+	     "\x42\x30\x3D\xD8\x00\xDEz\0\x00\xDEy\0\x3D\xD8x\0"
+	     "\xFF\xFFw\0q");
+    to_units_test(__LINE__, CS_UTF16BE, "\xD8\x3D\xDE\x00\xD8\x3D\xDE\x01"
+		  "\xDC\x00\xDC\x01\xFF\xFF\xDC\x02\0a", 18, errstr, 2);
+
+    /*
+     * BOM handling in CS_UTF16: a big-endian or little-endian BOM is
+     * swallowed and sets the byte order, a later one is a ZWNBSP,
+     * and with no BOM at all we assume big-endian. CS_UTF16BE
+     * swallows a leading BOM of its own byte order too.
+     */
+    TO_UNITS(CS_UTF16, "\xFE\xFF\0a\0b\xFE\xFF\xD8\x3D\xDE\x00\0c");
+    TO_UNITS(CS_UTF16, "\xFF\xFE" "a\0b\0\xFF\xFE\x3D\xD8\x00\xDE" "c\0");
+    TO_UNITS(CS_UTF16, "\0a\0b\xD8\x3D\xDE\x00\0c");
+    STOP(CS_UTF16, "\xFF\xFE" "a\0b\0", 8, 2, 0);
+    STOP(CS_UTF16BE, "\xFE\xFF\0a", 8, 1, 0);
+
+    /*
+     * A surrogate pair is never split: with room for only half of
+     * it, we stop before it, whether it comes from the fast path or
+     * from the decoder.
+     */
+    STOP(CS_UTF16BE, "\0a\0b\xD8\x3D\xDE\x00\0c", 3, 2, 3);
+    STOP(CS_UTF16BE, "\0a\0b\xD8\x3D\xDE\x00\0c", 4, 4, 1);
+    STOP(CS_UTF16BE, "\xD8\x3D\xDE\x00", 1, 0, 1);
+    STOP(CS_UTF8, "ab\xF0\x9F\x98\x80z", 3, 2, 2);
+    STOP(CS_UTF8, "ab\xF0\x9F\x98\x80z", 4, 4, 1);
+
+    /*
+     * Everywhere else we stop before the byte whose output doesn't
+     * fit, as charset_to_unicode_sz() does.
+     */
+    STOP(CS_UTF8, "ab\xC3\xA9" "c", 2, 2, 2);
+    STOP(CS_ISO2022_JP, "a\x1B$B0!0\"", 2, 2, 1);
+    STOP(CS_CP1252, "abc\x81", 3, 3, 1);
+
+    /*
+     * The SBCS table path, including undefined bytes, and other
+     * charsets going through the decoder and the ASCII path.
+     */
+    TO_UNITS(CS_CP1252, "abc\x80\x81\x8D\xE9\xFF");
+    to_units_test(__LINE__, CS_CP1252, "abc\x80\x81\x8D\xE9\xFF", 8,
+		  errstr, 2);
+    for (i = 0; i < 256; i++)
+	bytes[i] = (char)(255 - i);
+    to_units_test(__LINE__, CS_ISO8859_1, bytes, 256, NULL, 0);
+    to_units_test(__LINE__, CS_KOI8_R, bytes, 256, NULL, 0);
+    TO_UNITS(CS_UTF8, "ab\xC3\xA9\xF0\x9F\x98\x80\xFFz\xE2\x82");
+    TO_UNITS(CS_ISO2022_JP, "a\x1B$B0!0\"\x1B(Bb");
+    TO_UNITS(CS_UTF7, "a+AGEAYg-b+2D3eAA-");
+
+    printf("to_units tests completed\n");
+    printf("from_units tests beginning\n");
+
+    /*
+     * A shifted character, then enough ASCII to run past the first
+     * block of BMP characters, so that a stateful encoder has to
+     * remember it's shifted out across the boundary.
+     */
+    buf[0] = 0x3042;
+    for (i = 1; i < lenof(buf); i++)
+	buf[i] = 'a';
+    for (j = 0; j < lenof(charsets); j++) {
+	from_units_test(__LINE__, charsets[j], buf, 260, sizeof(buf));
+	from_units_test(__LINE__, charsets[j], buf, 260, 100);
+    }
+
+    /*
+     * Shifted characters on both sides of the boundary, and a
+     * surrogate pair straddling it (which only UTF-7 and UTF-8 can
+     * encode), then an unpaired surrogate.
+     */
+    for (i = 0; i < lenof(buf); i++)
+	buf[i] = (i % 7 ? 0x3042 + i % 50 : 'a' + i % 26);
+    buf[255] = 0xD83D;
+    buf[256] = 0xDE00;
+    for (j = 0; j < lenof(charsets); j++) {
+	from_units_test(__LINE__, charsets[j], buf, 255, sizeof(buf));
+	from_units_test(__LINE__, charsets[j], buf, 300, sizeof(buf));
+	from_units_test(__LINE__, charsets[j], buf, 300, 517);
+    }
+    buf[256] = 'a';
+    for (j = 0; j < lenof(charsets); j++)
+	from_units_test(__LINE__, charsets[j], buf, 300, sizeof(buf));
+
+    printf("from_units tests completed\n");
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
@@ -160,6 +160,32 @@ static void read_utf7(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * read_utf7 is part-way through a character if it has a high
+ * surrogate stored, if it has just seen the `+' which might begin
+ * the sequence `+-', or if it has accumulated at least one base64
+ * digit's worth of a halfword (as opposed to the few padding bits
+ * left over after extracting the last one).
+ */
+static int midchar_utf7(charset_spec const *charset,
+			charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return state->s1 != 0 || state->s0 == 2 || state->s0 >= 0x40;
+}
+
+/*
+ * Outside base64, everything but a `+' stands for itself.
+ */
+static const char *ascii_stops_utf7(charset_spec const *charset,
+				    charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return (state->s0 == 0 && state->s1 == 0 ? "+" : NULL);
+}
+
 /*
  * For writing UTF-7, we supply two charset definitions, one of
  * which will directly encode Set O characters and the other of
@@ -280,11 +306,15 @@ static int write_utf7(charset_spec const *charset, long int input_chr,
 }
 
 const charset_spec charset_CS_UTF7 = {
-    CS_UTF7, read_utf7, write_utf7, NULL
+    CS_UTF7, read_utf7, write_utf7, NULL,
+    NULL, NULL, NULL, NULL, midchar_utf7, ascii_stops_utf7, NULL,
+    7, 2, 1, CSF_RESET
 };
 
 const charset_spec charset_CS_UTF7_CONSERVATIVE = {
-    CS_UTF7_CONSERVATIVE, read_utf7, write_utf7, NULL
+    CS_UTF7_CONSERVATIVE, read_utf7, write_utf7, NULL,
+    NULL, NULL, NULL, NULL, midchar_utf7, ascii_stops_utf7, NULL,
+    7, 2, 1, CSF_RESET
 };
 
 #else /* ENUM_CHARSETS */
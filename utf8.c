@@ -192,6 +192,41 @@ void read_utf8(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * read_utf8 is part-way through a character exactly when its state
+ * is nonzero.
+ */
+static int midchar_utf8(charset_spec const *charset,
+			charset_state const *state)
+{
+    UNUSEDARG(charset);
+
+    return state->s0 != 0;
+}
+
+/*
+ * Once read_utf8 has seen a byte which can't be part of a longer
+ * sequence (ASCII, or FE or FF), its state is zero.
+ */
+static size_t sync_utf8(charset_spec const *charset,
+		       const unsigned char *input, size_t inlen, size_t pos,
+		       charset_state *state)
+{
+    UNUSEDARG(charset);
+
+    if (pos == 0)
+	pos = 1;
+    for (; pos < inlen; pos++) {
+	unsigned c = input[pos-1];
+
+	if (c < 0x80 || c >= 0xFE) {
+	    state->s0 = 0;
+	    return pos;
+	}
+    }
+    return inlen;
+}
+
 /*
  * UTF-8 is a stateless multi-byte encoding (in the sense that just
  * after any character has been completed, the state is always the
@@ -252,6 +287,227 @@ int write_utf8(charset_spec const *charset, long int input_chr,
     }
 }
 
+/*
+ * Block versions of read_utf8 and write_utf8. These deal only
+ * with complete, valid characters, and leave anything even
+ * slightly unusual (errors, or a character split across the end
+ * of the input) to the per-byte functions above.
+ */
+
+static size_t read_utf8_block(charset_spec const *charset,
+			      const char **input, size_t *inlen,
+			      charset_state *state, wchar_t *output,
+			      size_t outlen)
+{
+    const unsigned char *p = (const unsigned char *)*input;
+    const unsigned char *end = p + *inlen;
+    size_t i;
+    int len;
+    unsigned long charval, minval;
+
+    UNUSEDARG(charset);
+
+    /*
+     * If we're in mid-character, let read_utf8 finish it off.
+     */
+    if (state->s0 != 0)
+	return 0;
+
+    i = 0;
+    while (i < outlen && p < end) {
+	if (*p < 0x80) {
+	    i += ascii_widen(&p, end - p, output + i, outlen - i);
+	    continue;
+	}
+
+	if (*p >= 0xC2 && *p < 0xE0) {
+	    len = 2; charval = *p & 0x1F; minval = 0x80;
+	} else if (*p >= 0xE0 && *p < 0xF0) {
+	    len = 3; charval = *p & 0x0F; minval = 0x800;
+	} else if (*p >= 0xF0 && *p < 0xF8) {
+	    len = 4; charval = *p & 0x07; minval = 0x10000;
+	} else if (*p >= 0xF8 && *p < 0xFC) {
+	    len = 5; charval = *p & 0x03; minval = 0x200000;
+	} else if (*p >= 0xFC && *p < 0xFE) {
+	    len = 6; charval = *p & 0x01; minval = 0x4000000;
+	} else
+	    break;		       /* error, or overlong C0/C1 */
+
+	if (end - p < len)
+	    break;		       /* incomplete character */
+
+	{
+	    int j;
+	    for (j = 1; j < len; j++) {
+		if ((p[j] & 0xC0) != 0x80)
+		    break;
+		charval = (charval << 6) | (p[j] & 0x3F);
+	    }
+	    if (j < len)
+		break;		       /* truncated sequence */
+	}
+
+	/*
+	 * Apply the same validity checks as read_utf8.
+	 */
+	if (charval < minval ||
+	    (charval >= 0xD800 && charval < 0xE000) ||
+	    charval == 0xFFFE || charval == 0xFFFF)
+	    break;
+
+	output[i++] = charval;
+	p += len;
+    }
+
+    *inlen -= p - (const unsigned char *)*input;
+    *input = (const char *)p;
+    return i;
+}
+
+static size_t write_utf8_block(charset_spec const *charset,
+			       const wchar_t **input, size_t *inlen,
+			       charset_state *state, char *output,
+			       size_t outlen)
+{
+    const wchar_t *p = *input, *end = p + *inlen;
+    size_t o = 0;
+
+    UNUSEDARG(charset);
+    UNUSEDARG(state);
+
+    while (p < end) {
+	long int c = *p;
+
+	if (c < 0 || c == 0xFFFE || c == 0xFFFF ||
+	    (c >= 0xD800 && c < 0xE000))
+	    break;
+
+	if (c < 0x80) {
+	    if (outlen - o < 1) break;
+	    o += ascii_narrow(&p, end - p, output + o, outlen - o);
+	    continue;
+	} else if (c < 0x800) {
+	    if (outlen - o < 2) break;
+	    output[o++] = 0xC0 | (0x1F & (c >>  6));
+	    output[o++] = 0x80 | (0x3F & (c      ));
+	} else if (c < 0x10000) {
+	    if (outlen - o < 3) break;
+	    output[o++] = 0xE0 | (0x0F & (c >> 12));
+	    output[o++] = 0x80 | (0x3F & (c >>  6));
+	    output[o++] = 0x80 | (0x3F & (c      ));
+	} else if (c < 0x200000) {
+	    if (outlen - o < 4) break;
+	    output[o++] = 0xF0 | (0x07 & (c >> 18));
+	    output[o++] = 0x80 | (0x3F & (c >> 12));
+	    output[o++] = 0x80 | (0x3F & (c >>  6));
+	    output[o++] = 0x80 | (0x3F & (c      ));
+	} else {
+	    /*
+	     * Five- and six-byte characters are rare enough that
+	     * we leave them to write_utf8.
+	     */
+	    break;
+	}
+	p++;
+    }
+
+    *inlen -= p - *input;
+    *input = p;
+    return o;
+}
+
+/*
+ * Counting versions of read_utf8 and write_utf8.
+ * 
+ * When each error produces one output character, counting UTF-8
+ * is almost a matter of counting the bytes which aren't
+ * continuation bytes: every complete sequence produces exactly one
+ * character or one error, whether or not its value turns out to be
+ * valid. We need only track how many continuation bytes we're
+ * expecting, so as to notice stray ones and truncated sequences.
+ * 
+ * With any other length of error string we'd need to validate
+ * every character, so we leave that to read_utf8.
+ */
+
+static size_t read_utf8_count(charset_spec const *charset,
+			      const char **input, size_t *inlen,
+			      charset_state *state, size_t errlen)
+{
+    const unsigned char *p = (const unsigned char *)*input;
+    const unsigned char *end = p + *inlen, *start = p;
+    size_t count = 0, startcount = 0;
+    int need = 0;
+
+    UNUSEDARG(charset);
+
+    if (state->s0 != 0 || errlen != 1)
+	return 0;
+
+    while (p < end) {
+	unsigned c = *p++;
+
+	if (c >= 0x80 && c < 0xC0) {
+	    if (need == 0)
+		count++;	       /* stray continuation byte */
+	    else if (--need == 0)
+		count++;	       /* end of a sequence */
+	    continue;
+	}
+
+	if (need)
+	    count++;		       /* truncated sequence */
+	need = 0;
+	if (c < 0x80 || c >= 0xFE) {
+	    count++;		       /* ASCII, or FE/FF error */
+	} else {
+	    need = (c < 0xE0 ? 1 : c < 0xF0 ? 2 : c < 0xF8 ? 3 :
+		    c < 0xFC ? 4 : 5);
+	    start = p - 1;
+	    startcount = count;
+	}
+    }
+
+    /*
+     * If we've finished in mid-character, leave the last sequence
+     * for read_utf8, so that it gets into the state properly.
+     */
+    if (need) {
+	p = start;
+	count = startcount;
+    }
+
+    *inlen -= p - (const unsigned char *)*input;
+    *input = (const char *)p;
+    return count;
+}
+
+static size_t write_utf8_count(charset_spec const *charset,
+			       const wchar_t **input, size_t *inlen,
+			       charset_state *state)
+{
+    const wchar_t *p = *input, *end = p + *inlen;
+    size_t count = 0;
+
+    UNUSEDARG(charset);
+    UNUSEDARG(state);
+
+    for (; p < end; p++) {
+	long int c = *p;
+
+	if (c < 0)
+	    break;
+	if (c == 0xFFFE || c == 0xFFFF || (c >= 0xD800 && c < 0xE000))
+	    continue;		       /* write_utf8 refuses these */
+	count += (c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 :
+		  c < 0x200000 ? 4 : c < 0x4000000 ? 5 : 6);
+    }
+
+    *inlen -= p - *input;
+    *input = p;
+    return count;
+}
+
 #ifdef TESTMODE
 
 #include <stdio.h>
@@ -897,7 +1153,10 @@ int main(void)
 #endif /* TESTMODE */
 
 const charset_spec charset_CS_UTF8 = {
-    CS_UTF8, read_utf8, write_utf8, NULL
+    CS_UTF8, read_utf8, write_utf8, NULL,
+    read_utf8_block, write_utf8_block, read_utf8_count, write_utf8_count,
+    midchar_utf8, NULL, sync_utf8,
+    6, 0, 2, CSF_STATELESS | CSF_SELFSYNC | CSF_ASCII
 };
 
 #else /* ENUM_CHARSETS */
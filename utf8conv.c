@@ -0,0 +1,342 @@
+/*
+ * utf8conv.c - convert between any charset and UTF-8 without the
+ * caller going through a buffer of wchar_t.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * Encode a character as UTF-8 in the same way as write_utf8().
+ * Returns the number of bytes, or 0 if it's one of the code points
+ * write_utf8() refuses to output.
+ */
+static int utf8_encode(long int c, unsigned char *buf)
+{
+    unsigned long lim;
+    int n, i;
+
+    if (c < 0 || c == 0xFFFE || c == 0xFFFF || (c >= 0xD800 && c < 0xE000))
+	return 0;
+    if (c < 0x80) {
+	buf[0] = (unsigned char)c;
+	return 1;
+    }
+    for (n = 2, lim = 0x800; n < 6 && (unsigned long)c >= lim; n++)
+	lim <<= 5;
+    for (i = n-1; i > 0; i--) {
+	buf[i] = (unsigned char)(0x80 | (c & 0x3F));
+	c >>= 6;
+    }
+    buf[0] = (unsigned char)((0xFF00 >> n) | c);
+    return n;
+}
+
+static void utf8_emit(void *ctx, long int output)
+{
+    static const unsigned char replacement[] = { 0xEF, 0xBF, 0xBD };
+    struct units_param *param = (struct units_param *)ctx;
+    unsigned char buf[6];
+    int n;
+
+    if (param->stopped)
+	return;
+    if (output != ERROR && (n = utf8_encode(output, buf)) > 0)
+	units_put(param, buf, n);
+    else if (param->errstr)
+	units_put(param, param->errstr, param->errlen);
+    else
+	units_put(param, replacement, sizeof(replacement));
+}
+
+static void utf8_block(charset_spec const *spec,
+		       const char **input, size_t *inlen,
+		       charset_state *state, struct units_param *param)
+{
+    const unsigned char *p = (const unsigned char *)*input;
+    size_t i, n;
+
+    if (spec->read == read_sbcs) {
+	/*
+	 * A single-byte charset has the UTF-8 for each byte ready
+	 * in its table, so we can simply copy it out. Undefined
+	 * bytes go through the decoder to be reported.
+	 */
+	const struct sbcs_data *sd = (const struct sbcs_data *)spec->data;
+
+	for (i = 0; i < *inlen; i++) {
+	    const unsigned char *u = sd->sbcs2utf8[p[i]];
+	    size_t len = (u[0] < 0x80 ? 1 : u[0] < 0xE0 ? 2 :
+			  u[0] < 0xF0 ? 3 : 4);
+
+	    if (u[0] == 0xFF)
+		break;
+	    units_put(param, u, len);
+	    if (param->stopped)
+		break;
+	}
+	*input += i;
+	*inlen -= i;
+    } else if (spec->read == read_utf8 && !spec->midchar(spec, state)) {
+	/*
+	 * Valid UTF-8 decodes and re-encodes to exactly the same
+	 * bytes, so we can copy as much of it as fits.
+	 */
+	n = validate_utf8(p, *inlen < param->outlen ? *inlen : param->outlen);
+	units_put(param, p, n);
+	*input += n;
+	*inlen -= n;
+    }
+}
+
+/*
+ * ASCII is the same in UTF-8.
+ */
+static void utf8_ascii(struct units_param *param, const unsigned char *p,
+		       size_t n)
+{
+    units_put(param, p, n);
+}
+
+static const struct units_writer utf8_writer = {
+    1, utf8_emit, utf8_ascii, utf8_block
+};
+
+size_t charset_to_utf8(const char **input, size_t *inlen,
+		       char *output, size_t outlen,
+		       int charset, charset_state *state,
+		       const char *errstr, size_t errlen)
+{
+    return spec_to_units(charset_find_spec(charset), input, inlen,
+			 output, outlen, state, errstr, errlen, &utf8_writer);
+}
+
+size_t charset_from_utf8(const char **input, size_t *inlen,
+			 char *output, size_t outlen,
+			 int charset, charset_state *state, int *error)
+{
+    charset_spec const *utf8 = charset_find_spec(CS_UTF8);
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state utf8state = CHARSET_INIT_STATE;
+    const unsigned char *p;
+    size_t ret;
+
+    if (!input)
+	return spec_convert(utf8, spec, NULL, NULL, output, outlen,
+			    &utf8state, state, error, NULL);
+
+    if (error)
+	*error = FALSE;
+    ret = spec_convert(utf8, spec, input, inlen, output, outlen,
+		       &utf8state, state, error, NULL);
+
+    /*
+     * We have no state of our own for the UTF-8, so if we stopped
+     * part-way through a sequence (because the input ran out, or
+     * the output did, or at an error), give back the bytes of it we
+     * had taken, so that the next call starts at its lead byte.
+     * Those can only be the lead byte and some continuation bytes.
+     */
+    if (utf8->midchar(utf8, &utf8state)) {
+	p = (const unsigned char *)*input;
+	do {
+	    p--;
+	    (*inlen)++;
+	} while ((*p & 0xC0) == 0x80);
+	*input = (const char *)p;
+    }
+
+    return ret;
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+#include <string.h>
+
+int total_errs = 0;
+
+/*
+ * Decode `input' with charset_to_unicode_sz(), with U+FFFF standing
+ * in for errors, and encode the result as UTF-8 by hand, errors
+ * becoming `errstr' or U+FFFD.
+ */
+size_t reference_utf8(int charset, const char *input, size_t inlen,
+		      const char *errstr, char *out)
+{
+    wchar_t wbuf[512];
+    charset_state state = CHARSET_INIT_STATE;
+    size_t i, n, len = 0;
+
+    n = charset_to_unicode_sz(&input, &inlen, wbuf, lenof(wbuf), charset,
+			      &state, L"\xFFFF", 1);
+    for (i = 0; i < n; i++) {
+	unsigned char buf[6];
+	int k;
+
+	if (wbuf[i] == 0xFFFF) {
+	    if (errstr) {
+		memcpy(out + len, errstr, strlen(errstr));
+		len += strlen(errstr);
+		continue;
+	    }
+	    wbuf[i] = 0xFFFD;
+	}
+	k = utf8_encode(wbuf[i], buf);
+	memcpy(out + len, buf, k);
+	len += k;
+    }
+    return len;
+}
+
+/*
+ * Convert `input' with charset_to_utf8(), in two pieces split at
+ * every point in turn, and then in one piece into output buffers of
+ * every size from 4 bytes up (carrying on with a fresh buffer each
+ * time one fills), and check it all against reference_utf8().
+ */
+void to_utf8_test(int line, int charset, const char *input, size_t inlen,
+		  const char *errstr)
+{
+    char expected[2048], output[2048];
+    size_t explen, split, outlen;
+    size_t errlen = (errstr ? strlen(errstr) : 0);
+
+    explen = reference_utf8(charset, input, inlen, errstr, expected);
+
+    for (split = 0; split <= inlen; split++) {
+	charset_state state = CHARSET_INIT_STATE;
+	const char *p = input;
+	size_t left = split, len;
+
+	len = charset_to_utf8(&p, &left, output, sizeof(output), charset,
+			      &state, errstr, errlen);
+	left = inlen - split;
+	len += charset_to_utf8(&p, &left, output + len, sizeof(output) - len,
+			       charset, &state, errstr, errlen);
+	if (len != explen || memcmp(output, expected, len)) {
+	    printf("%d: split at %d: output differs\n", line, (int)split);
+	    total_errs++;
+	    return;
+	}
+    }
+
+    for (outlen = 4; outlen <= explen + 1; outlen++) {
+	charset_state state = CHARSET_INIT_STATE;
+	const char *p = input;
+	size_t left = inlen, len = 0, ret;
+
+	do {
+	    ret = charset_to_utf8(&p, &left, output + len, outlen, charset,
+				  &state, errstr, errlen);
+	    if (ret > outlen) {
+		printf("%d: outlen %d: wrote %d bytes\n",
+		       line, (int)outlen, (int)ret);
+		total_errs++;
+		return;
+	    }
+	    len += ret;
+	} while (left > 0 && ret > 0);
+	if (left > 0 || len != explen || memcmp(output, expected, len)) {
+	    printf("%d: outlen %d: output differs\n", line, (int)outlen);
+	    total_errs++;
+	    return;
+	}
+    }
+
+    {
+	const char *p = input;
+	size_t left = inlen;
+
+	if (charset_to_utf8(&p, &left, NULL, CHARSET_UNBOUNDED, charset,
+			    NULL, errstr, errlen) != explen || left != 0) {
+	    printf("%d: dry run gave the wrong length\n", line);
+	    total_errs++;
+	}
+    }
+}
+
+#define TO_UTF8(charset, input, errstr) \
+    to_utf8_test(__LINE__, charset, input, sizeof(input)-1, errstr)
+
+/*
+ * Convert `input' from UTF-8 with charset_from_utf8() into `outlen'
+ * bytes, and check the output and how much input is left.
+ */
+void from_utf8_test(int line, int charset, const char *input, size_t inlen,
+		    size_t outlen, const char *expected, size_t explen,
+		    size_t expleft)
+{
+    char output[256];
+    charset_state state = CHARSET_INIT_STATE;
+    const char *p = input;
+    size_t left = inlen, ret;
+
+    ret = charset_from_utf8(&p, &left, output, outlen, charset, &state,
+			    NULL);
+    if (ret != explen || memcmp(output, expected, ret)) {
+	printf("%d: output differs\n", line);
+	total_errs++;
+    }
+    if (left != expleft || p != input + inlen - expleft) {
+	printf("%d: %d bytes left, expected %d\n",
+	       line, (int)left, (int)expleft);
+	total_errs++;
+    }
+}
+
+#define FROM_UTF8(charset, input, outlen, expected, expleft) \
+    from_utf8_test(__LINE__, charset, input, sizeof(input)-1, outlen, \
+		   expected, sizeof(expected)-1, expleft)
+
+int main(void)
+{
+    char all[256];
+    int i;
+
+    /*
+     * The SBCS table path, including bytes it has to leave to the
+     * decoder because they're undefined.
+     */
+    TO_UTF8(CS_CP1252, "abc\x80\x81\x8D\xE9\xFF", NULL);
+    TO_UTF8(CS_CP1252, "abc\x80\x81\x8D\xE9\xFF", "<?>");
+    TO_UTF8(CS_KOI8_R, "\xE1\xE2 \xF7\xC1", NULL);
+    for (i = 0; i < 256; i++)
+	all[i] = (char)(255 - i);
+    to_utf8_test(__LINE__, CS_ISO8859_1, all, 256, NULL);
+    to_utf8_test(__LINE__, CS_CP1252, all, 256, "?");
+
+    /*
+     * UTF-8 copied straight through, up to each kind of invalid or
+     * incomplete sequence.
+     */
+    TO_UTF8(CS_UTF8, "ab\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80z", NULL);
+    TO_UTF8(CS_UTF8, "ab\xC3\xA9\xFF\xE2\x82\xAC", NULL);
+    TO_UTF8(CS_UTF8, "ab\xE2\x82z\xC3\xA9", NULL);
+    TO_UTF8(CS_UTF8, "ab\xC0\x80\xC3\xA9", "?");
+    TO_UTF8(CS_UTF8, "ab\xED\xA0\x80\xC3\xA9", NULL);
+    TO_UTF8(CS_UTF8, "\xC3\xA9\x80\x80x\xF0\x9F\x98", NULL);
+
+    /*
+     * Other charsets going through the decoder and the ASCII path.
+     */
+    TO_UTF8(CS_ISO2022_JP, "a\x1B$B0!0\"\x1B(Bb", NULL);
+    TO_UTF8(CS_UTF7, "a+AGEAYg-b+2D3eAA-", NULL);
+    TO_UTF8(CS_SHIFT_JIS, "a\x83\x41\x83z\x83", NULL);
+
+    /*
+     * charset_from_utf8() gives back a partial sequence at the end,
+     * or one it stopped part-way through because the output was
+     * full, so that the next call can start again at its lead byte.
+     */
+    FROM_UTF8(CS_CP1252, "a\xE2\x82", 16, "a", 2);
+    FROM_UTF8(CS_CP1252, "a\xE2\x82\xAC", 16, "a\x80", 0);
+    FROM_UTF8(CS_CP1252, "a\xF0\x9F\x98", 16, "a", 3);
+    FROM_UTF8(CS_CP1252, "\xC3\xA9\xC3\xA9", 1, "\xE9", 2);
+    FROM_UTF8(CS_CP1252, "\xC3", 16, "", 1);
+
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */
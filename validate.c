@@ -0,0 +1,340 @@
+/*
+ * validate.c - check input for well-formedness without converting
+ * it.
+ */
+
+#include "charset.h"
+#include "internal.h"
+
+/*
+ * Each of the following returns the offset of the first invalid
+ * sequence in its input, or `len' if there isn't one.
+ */
+
+static size_t validate_sbcs(const sbcs_data *sd, int ascii,
+			    const unsigned char *p, size_t len)
+{
+    size_t i;
+
+    /*
+     * Plenty of SBCSes define every byte value, in which case
+     * there's nothing to check.
+     */
+    for (i = 0; i < lenof(sd->valid); i++)
+	if (sd->valid[i] != 0xFFFFFFFFUL)
+	    break;
+    if (i == lenof(sd->valid))
+	return len;
+
+    i = 0;
+    while (i < len) {
+	if (ascii) {
+	    /* ASCII bytes are known to be fine, so skip them quickly */
+	    i += ascii_span(p + i, len - i);
+	    while (i < len && p[i] >= 0x80) {
+		if (!(sd->valid[p[i] >> 5] & (1UL << (p[i] & 31))))
+		    return i;
+		i++;
+	    }
+	} else {
+	    if (!(sd->valid[p[i] >> 5] & (1UL << (p[i] & 31))))
+		return i;
+	    i++;
+	}
+    }
+    return len;
+}
+
+/*
+ * This must agree exactly with what read_utf8 considers an error:
+ * stray continuation bytes, FE and FF, truncated and overlong
+ * sequences, surrogates, and U+FFFE and U+FFFF. (Five- and six-
+ * byte sequences are accepted, as they are by read_utf8.)
+ */
+size_t validate_utf8(const unsigned char *p, size_t len)
+{
+    static const unsigned long minval[7] = {
+	0, 0, 0x80, 0x800, 0x10000, 0x200000, 0x4000000
+    };
+    size_t i = 0, j, n;
+    unsigned long c;
+
+    while (1) {
+	i += ascii_span(p + i, len - i);
+	if (i >= len)
+	    return len;
+
+	c = p[i];
+	if (c < 0xC0 || c >= 0xFE) {
+	    return i;
+	} else if (c < 0xE0) {
+	    n = 2;
+	    c &= 0x1F;
+	} else if (c < 0xF0) {
+	    n = 3;
+	    c &= 0x0F;
+	} else if (c < 0xF8) {
+	    n = 4;
+	    c &= 0x07;
+	} else if (c < 0xFC) {
+	    n = 5;
+	    c &= 0x03;
+	} else {
+	    n = 6;
+	    c &= 0x01;
+	}
+
+	if (len - i < n)
+	    return i;
+	for (j = 1; j < n; j++) {
+	    if ((p[i+j] & 0xC0) != 0x80)
+		return i;
+	    c = (c << 6) | (p[i+j] & 0x3F);
+	}
+	if (c < minval[n] || (c >= 0xD800 && c < 0xE000) ||
+	    c == 0xFFFE || c == 0xFFFF)
+	    return i;
+	i += n;
+    }
+}
+
+/*
+ * In UTF-16, the only possible errors are unpaired surrogates,
+ * U+FFFF (which read_utf16 can't tell from ERROR) and a trailing
+ * odd byte.
+ */
+static size_t validate_utf16(const unsigned char *p, size_t len,
+			     int bigendian)
+{
+    size_t i = 0;
+    int hi = (bigendian ? 0 : 1);
+
+    while (1) {
+	i += utf16_plain_span(p + i, len - i, bigendian);
+	if (i == len)
+	    return len;
+	if (len - i < 4 || (p[i+hi] & 0xFC) != 0xD8 ||
+	    (p[i+2+hi] & 0xFC) != 0xDC)
+	    return i;
+	i += 4;
+    }
+}
+
+struct validate_emit_ctx {
+    int nemitted;
+    int firsterr;		       /* index of first ERROR, or -1 */
+};
+
+static void validate_emit(void *vctx, long int output)
+{
+    struct validate_emit_ctx *ctx = (struct validate_emit_ctx *)vctx;
+
+    if (output == ERROR && ctx->firsterr < 0)
+	ctx->firsterr = ctx->nemitted;
+    ctx->nemitted++;
+}
+
+/*
+ * For everything else, we just run the decoder and watch for it
+ * emitting ERROR. We keep track of where the current character
+ * began in the same way as charset_to_unicode_errors().
+ */
+static size_t validate_generic(charset_spec const *spec,
+			       const char *input, size_t len)
+{
+    charset_state state = CHARSET_INIT_STATE;
+    struct validate_emit_ctx ctx;
+    const char *p = input;
+    size_t n = len, start = 0, pos;
+    int partial;
+
+    while (n > 0) {
+	if (spec->read_block) {
+	    wchar_t scratch[256];
+	    size_t before;
+
+	    do {
+		before = n;
+		spec->read_block(spec, &p, &n, &state,
+				 scratch, lenof(scratch));
+	    } while (n > 0 && n < before);
+
+	    if (!(spec->midchar && spec->midchar(spec, &state)))
+		start = p - input;
+	    if (n == 0)
+		break;
+	}
+
+	ctx.nemitted = 0;
+	ctx.firsterr = -1;
+	spec->read(spec, (unsigned char)*p, &state, validate_emit, &ctx);
+	pos = p - input;
+	partial = spec->midchar && spec->midchar(spec, &state);
+
+	if (ctx.firsterr >= 0) {
+	    /*
+	     * The error belongs to the sequence this byte completed,
+	     * unless this byte also produced something after it (or
+	     * began something new), in which case it was the
+	     * sequence before this byte which was broken.
+	     */
+	    if (!partial && ctx.firsterr == ctx.nemitted - 1 &&
+		ctx.nemitted > 1)
+		return pos;
+	    return start;
+	}
+
+	if (!partial)
+	    start = pos + 1;
+	else if (ctx.nemitted > 0)
+	    start = pos;
+	p++;
+	n--;
+    }
+
+    /*
+     * Input which stops part-way through a character is invalid.
+     */
+    if (spec->midchar && spec->midchar(spec, &state))
+	return start;
+    return len;
+}
+
+int charset_validate(int charset, const char *input, size_t inlen,
+		     size_t *badoffset)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    const unsigned char *p = (const unsigned char *)input;
+    size_t bad;
+
+    if (spec->read == read_sbcs)
+	bad = validate_sbcs(spec->data, spec->flags & CSF_ASCII, p, inlen);
+    else if (spec->read == read_utf8)
+	bad = validate_utf8(p, inlen);
+    else if (spec->read == read_utf16)
+	bad = validate_utf16(p, inlen,
+			     utf16_input_bigendian(spec, p, inlen));
+    else
+	bad = validate_generic(spec, input, inlen);
+
+    if (badoffset)
+	*badoffset = bad;
+    return bad == inlen;
+}
+
+#ifdef TESTMODE
+
+#include <stdio.h>
+
+int total_errs = 0;
+
+static void validate_errfn(void *ctx, size_t offset, size_t length)
+{
+    size_t *first = (size_t *)ctx;
+
+    UNUSEDARG(length);
+    if (*first == (size_t)-1)
+	*first = offset;
+}
+
+/*
+ * Check that charset_validate() finds its first bad sequence at
+ * `bad' (or finds none, if `bad' is `inlen'), and that
+ * charset_to_unicode_errors() agrees. The decoder doesn't count
+ * input which stops part-way through a character as an error, so
+ * in that case it should report nothing at all.
+ */
+void validate_test(int line, int charset, const char *input, int inlen,
+		   int bad)
+{
+    charset_spec const *spec = charset_find_spec(charset);
+    charset_state state = CHARSET_INIT_STATE;
+    wchar_t output[1024];
+    const char *p = input;
+    size_t n = inlen, offset, first = (size_t)-1;
+    int ret;
+
+    ret = charset_validate(charset, input, inlen, &offset);
+    if (ret != (bad == inlen) || offset != (size_t)bad) {
+	printf("%d: validate returned %d at offset %d, should be %d at %d\n",
+	       line, ret, (int)offset, bad == inlen, bad);
+	total_errs++;
+    }
+
+    charset_to_unicode_errors(&p, &n, output, lenof(output), charset,
+			      &state, NULL, 0, validate_errfn, &first);
+    if (spec->midchar && spec->midchar(spec, &state)) {
+	if (first != (size_t)-1) {
+	    printf("%d: decoder found error at %d in unfinished input\n",
+		   line, (int)first);
+	    total_errs++;
+	}
+    } else if (first != (bad == inlen ? (size_t)-1 : (size_t)bad)) {
+	printf("%d: decoder found first error at %d, validate at %d\n",
+	       line, (int)first, bad);
+	total_errs++;
+    }
+}
+
+/* Macro to concoct the first three parameters of validate_test. */
+#define TESTSTR(cs, x) __LINE__, cs, x, sizeof(x)-1
+
+int main(void)
+{
+    char buf[512];
+    int i;
+
+    printf("validate tests beginning\n");
+
+    /* SBCS */
+    validate_test(TESTSTR(CS_ASCII, "plain text\n"), 11);
+    validate_test(TESTSTR(CS_ASCII, "caf\xe9"), 3);
+    validate_test(TESTSTR(CS_ISO8859_1, "caf\xe9"), 4);
+
+    /* UTF-8: bad sequences, overlong forms and a truncated character */
+    validate_test(TESTSTR(CS_UTF8, "caf\xc3\xa9"), 5);
+    validate_test(TESTSTR(CS_UTF8, "a\xc0\x80z"), 1);
+    validate_test(TESTSTR(CS_UTF8, "ab\x80z"), 2);
+    validate_test(TESTSTR(CS_UTF8, "ab\xe2\x82"), 2);
+    validate_test(TESTSTR(CS_UTF8, "\xed\xa0\x80"), 0);
+
+    /* UTF-16: surrogates, U+FFFF and a trailing odd byte */
+    validate_test(TESTSTR(CS_UTF16BE, "\0A\xd8\x3d\xde\x00\0B"), 8);
+    validate_test(TESTSTR(CS_UTF16BE, "\0A\xde\x00\0B"), 2);
+    validate_test(TESTSTR(CS_UTF16BE, "\0A\xd8\x3d\0B"), 2);
+    validate_test(TESTSTR(CS_UTF16BE, "\0A\xff\xff\0B"), 2);
+    validate_test(TESTSTR(CS_UTF16BE, "\0A\xff\xfe\0B"), 6);
+    validate_test(TESTSTR(CS_UTF16BE, "\0A\0"), 2);
+    validate_test(TESTSTR(CS_UTF16LE, "A\0\xff\xff"), 2);
+    validate_test(TESTSTR(CS_UTF16LE, "A\0\x3d\xd8\0\xde"), 6);
+    validate_test(TESTSTR(CS_UTF16, "\xff\xfe" "A\0\xff\xff"), 4);
+    validate_test(TESTSTR(CS_UTF16, "\xfe\xff\0A\xff\xff"), 4);
+
+    /* Long enough to go through the vectorised scans */
+    for (i = 0; i < (int)sizeof(buf); i += 2) {
+	buf[i] = 0;
+	buf[i+1] = 'a' + i % 26;
+    }
+    validate_test(__LINE__, CS_UTF16BE, buf, sizeof(buf), sizeof(buf));
+    buf[300] = buf[301] = (char)0xFF;
+    validate_test(__LINE__, CS_UTF16BE, buf, sizeof(buf), 300);
+    validate_test(__LINE__, CS_UTF16LE, buf, sizeof(buf), 300);
+    buf[300] = (char)0xD8;
+    validate_test(__LINE__, CS_UTF16BE, buf, sizeof(buf), 300);
+    buf[200] = (char)0xDC;
+    validate_test(__LINE__, CS_UTF16LE, buf + 1, 400, 198);
+
+    /* Everything else goes through the decoder */
+    validate_test(TESTSTR(CS_ISO2022_JP, "\x1b$BF|K\\\x1b(B\n"), 11);
+    validate_test(TESTSTR(CS_ISO2022_JP, "\x1b$BF|K\x1b(B\n"), 5);
+    validate_test(TESTSTR(CS_EUC_JP, "\xc6\xfc\xcb\xdc\xb8"), 4);
+    validate_test(TESTSTR(CS_SHIFT_JIS, "a\x93\xfa\x96{\x8c"), 5);
+    validate_test(TESTSTR(CS_HZ, "~{F|~}a~{F\n"), 9);
+    validate_test(TESTSTR(CS_HZ, "~{F|~}a~{F"), 9);
+
+    printf("validate tests completed\n");
+    printf("total: %d errors\n", total_errs);
+    return (total_errs != 0);
+}
+
+#endif /* TESTMODE */